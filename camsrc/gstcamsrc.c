@@ -62,15 +62,19 @@
 
 #include <gst/gst.h>
 #include <stdio.h>
-#include <poll.h>
+#include <string.h>
+#include <errno.h>
 #include <gst/allocators/gstdmabuf.h>
 #include <gst/allocators/gstfdmemory.h>
+#include <gst/video/video.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
+#include <time.h>
 
 #include <linux/videodev2.h>
 
@@ -83,7 +87,9 @@ GST_DEBUG_CATEGORY_STATIC (gst_camsrc_debug);
 #define VERSION "1.0.0"
 #define FRAME_SIZE 8294400
 #define FIELD_NAME_LENGTH 100
-#define NUM_BUFFERS 6
+#define FRAME_WAIT_TIMEOUT (2 * GST_SECOND)
+
+static const char *subsystem = "libv4l2-camera-plugin.so.1";
 
 /* Filter signals and args */
 enum
@@ -96,7 +102,8 @@ enum
 {
     PROP_0,
     PROP_DEVICE,
-    PROP_IOMODE
+    PROP_IOMODE,
+    PROP_BUFFER_COUNT
 };
 
 /* the capabilities of the inputs and outputs.
@@ -112,11 +119,6 @@ static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
 #define gst_camsrc_parent_class parent_class
 G_DEFINE_TYPE (Gstcamsrc, gst_camsrc, GST_TYPE_PUSH_SRC);
 
-GstMemory *dma_memory[NUM_BUFFERS];
-GstAllocator *dma_alloc;
-GstCaps *caps = NULL;
-int dma_fd[NUM_BUFFERS];
-
 GType gst_camsrc_iomode_get_type(void)
 {
     static GType g_type=0;
@@ -133,10 +135,12 @@ GType gst_camsrc_iomode_get_type(void)
 }
 
 static gboolean gst_camsrc_negotiate (GstBaseSrc * basesrc);
+static GstCaps *gst_camsrc_get_caps (GstBaseSrc * basesrc, GstCaps * filter);
 static void gst_camsrc_set_property (GObject * object, guint prop_id,
         const GValue * value, GParamSpec * pspec);
 static void gst_camsrc_get_property (GObject * object, guint prop_id,
         GValue * value, GParamSpec * pspec);
+static void gst_camsrc_finalize (GObject * object);
 static GstStateChangeReturn
 gst_camsrc_change_state (GstPushSrc * element, GstStateChange transition);
 
@@ -145,6 +149,9 @@ static GstFlowReturn gst_camsrc_chain (GstPad * pad, GstObject * parent, GstBuff
 static GstFlowReturn gst_camsrc_create (GstPushSrc * src, GstBuffer ** out);
 static GstFlowReturn gst_camsrc_fill (GstPushSrc * src, GstBuffer * out);
 static gboolean gst_camsrc_decide_allocation (GstBaseSrc * src, GstQuery * query);
+static gboolean gst_camsrc_query (GstBaseSrc * src, GstQuery * query);
+static gboolean gst_camsrc_unlock (GstBaseSrc * src);
+static gboolean gst_camsrc_unlock_stop (GstBaseSrc * src);
 
 /* GObject vmethod implementations */
 
@@ -164,6 +171,7 @@ gst_camsrc_class_init (GstcamsrcClass * klass)
 
     gobject_class->set_property = gst_camsrc_set_property;
     gobject_class->get_property = gst_camsrc_get_property;
+    gobject_class->finalize = gst_camsrc_finalize;
 
     gstelement_class->change_state = gst_camsrc_change_state;
 
@@ -174,10 +182,19 @@ gst_camsrc_class_init (GstcamsrcClass * klass)
             g_param_spec_enum("iomode","iomode","Memory mode",
                 GST_TYPE_CAMSRC_IOMODE,DEFAULT_PROP_IOMODE,
                 (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+    g_object_class_install_property (gobject_class, PROP_BUFFER_COUNT,
+            g_param_spec_uint ("buffer-count", "buffer-count",
+                "Buffers camsrc keeps in flight on top of what downstream asks for",
+                1, NUM_BUFFERS, DEFAULT_PROP_BUFFER_COUNT,
+                (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 
     basesrc_class->negotiate = GST_DEBUG_FUNCPTR (gst_camsrc_negotiate);
+    basesrc_class->get_caps = GST_DEBUG_FUNCPTR (gst_camsrc_get_caps);
     pushsrc_class->create = GST_DEBUG_FUNCPTR (gst_camsrc_create);
     basesrc_class->decide_allocation = GST_DEBUG_FUNCPTR (gst_camsrc_decide_allocation);
+    basesrc_class->query = GST_DEBUG_FUNCPTR (gst_camsrc_query);
+    basesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_camsrc_unlock);
+    basesrc_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_camsrc_unlock_stop);
 
     gst_element_class_set_static_metadata (gstelement_class,
             "Camera Source",
@@ -202,8 +219,41 @@ gst_camsrc_init (Gstcamsrc * filter)
     gst_element_add_pad (GST_ELEMENT (filter), filter->srcpad);
 
     gst_base_src_set_format (GST_BASE_SRC (filter), GST_FORMAT_TIME);
+    gst_base_src_set_live (GST_BASE_SRC (filter), TRUE);
     filter->device = NULL;
     filter->mode = 0;
+    filter->buffer_count = DEFAULT_PROP_BUFFER_COUNT;
+    filter->p_h_camera = NULL;
+    filter->poll = gst_poll_new (TRUE);
+    gst_poll_fd_init (&filter->poll_fd);
+    filter->pool = NULL;
+    filter->started = FALSE;
+    memset(&filter->streamformat, 0, sizeof(filter->streamformat));
+    filter->caps = NULL;
+    filter->probed_caps = NULL;
+    filter->dma_alloc = NULL;
+    memset(filter->dma_memory, 0, sizeof(filter->dma_memory));
+    memset(filter->dma_fd, -1, sizeof(filter->dma_fd));
+    filter->dma_count = 0;
+    filter->session = NULL;
+    g_mutex_init (&filter->hal_lock);
+    filter->capture_time = GST_CLOCK_TIME_NONE;
+    memset(filter->userptr_buffers, 0, sizeof(filter->userptr_buffers));
+    memset(filter->userptr_bufs, 0, sizeof(filter->userptr_bufs));
+}
+
+static void
+gst_camsrc_finalize (GObject * object)
+{
+    Gstcamsrc *filter = GST_CAMSRC (object);
+
+    g_free (filter->device);
+    gst_caps_replace (&filter->caps, NULL);
+    gst_caps_replace (&filter->probed_caps, NULL);
+    gst_poll_free (filter->poll);
+    g_mutex_clear (&filter->hal_lock);
+
+    G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 static void
@@ -214,63 +264,255 @@ gst_camsrc_set_property (GObject * object, guint prop_id,
 
     switch (prop_id) {
         case PROP_DEVICE:
+            g_free (filter->device);
             filter->device = g_value_dup_string (value);
             break;
         case PROP_IOMODE:
             filter->mode = g_value_get_enum(value);
             break;
+        case PROP_BUFFER_COUNT:
+            filter->buffer_count = g_value_get_uint(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
             break;
     }
 }
 
-static gboolean set_value (GQuark field, const GValue * value, gpointer pfx)
+static gboolean set_value (GQuark field, const GValue * value, gpointer data)
 {
+    stream_format_t *streamformat = (stream_format_t *) data;
     gchar *str = gst_value_serialize (value);
     gchar *field_name = g_quark_to_string (field);
     int field_value = atoi(str);
 
     if ((strcasecmp(field_name,"width") == 0) && (field_value > 0))
     {
-        streamformat.stream_width = field_value;
+        streamformat->stream_width = field_value;
     }
     else if ((strcasecmp(field_name,"height") == 0) && (field_value > 0))
     {
-        streamformat.stream_height = field_value;
+        streamformat->stream_height = field_value;
     }
     else if ((strcasecmp(field_name,"framerate") == 0) && (field_value > 0))
     {
-        streamformat.stream_fps = field_value;
+        streamformat->stream_fps = field_value;
     }
     else if ((strcasecmp(field_name,"format") == 0))
     {
         if ((strcasecmp(str,"YUY2") == 0) || (strcasecmp(str,"YUYV") == 0))
-            streamformat.pixel_format = CAMERA_PIXEL_FORMAT_YUYV;
+            streamformat->pixel_format = CAMERA_PIXEL_FORMAT_YUYV;
+        else if (strcasecmp(str,"NV12") == 0)
+            streamformat->pixel_format = CAMERA_PIXEL_FORMAT_NV12;
     }
     g_free (str);
     return TRUE;
 }
 
+typedef struct
+{
+    GstStructure *structure;
+    guint64 pixel_rate;
+    guint order;
+} GstCamsrcMode;
+
+/* Only formats the HAL's stream_format_t can request are offered */
+static GstStructure *
+gst_camsrc_format_structure (guint32 fourcc)
+{
+    switch (fourcc)
+    {
+        case V4L2_PIX_FMT_YUYV:
+            return gst_structure_new ("video/x-raw", "format", G_TYPE_STRING, "YUY2", NULL);
+        case V4L2_PIX_FMT_NV12:
+            return gst_structure_new ("video/x-raw", "format", G_TYPE_STRING, "NV12", NULL);
+        case V4L2_PIX_FMT_MJPEG:
+        case V4L2_PIX_FMT_JPEG:
+            return gst_structure_new_empty ("image/jpeg");
+        default:
+            return NULL;
+    }
+}
+
+/* Sets the frame rates offered at one size and returns the highest */
+static guint
+gst_camsrc_add_framerates (int fd, guint32 fourcc, guint32 width, guint32 height,
+        GstStructure * structure)
+{
+    struct v4l2_frmivalenum ival;
+    GValue rates = G_VALUE_INIT;
+    GValue rate = G_VALUE_INIT;
+    guint max_fps = 0;
+
+    g_value_init (&rates, GST_TYPE_LIST);
+    memset (&ival, 0, sizeof (ival));
+    ival.pixel_format = fourcc;
+    ival.width = width;
+    ival.height = height;
+    for (ival.index = 0; ioctl (fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ival.index++)
+    {
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+        {
+            if (ival.discrete.numerator == 0)
+                continue;
+            g_value_init (&rate, GST_TYPE_FRACTION);
+            gst_value_set_fraction (&rate, ival.discrete.denominator, ival.discrete.numerator);
+            gst_value_list_append_and_take_value (&rates, &rate);
+            max_fps = MAX (max_fps, ival.discrete.denominator / ival.discrete.numerator);
+        }
+        else
+        {
+            /* the shortest interval is the highest rate */
+            if (ival.stepwise.min.numerator == 0 || ival.stepwise.max.numerator == 0)
+                break;
+            g_value_init (&rate, GST_TYPE_FRACTION_RANGE);
+            gst_value_set_fraction_range_full (&rate,
+                    ival.stepwise.max.denominator, ival.stepwise.max.numerator,
+                    ival.stepwise.min.denominator, ival.stepwise.min.numerator);
+            gst_value_list_append_and_take_value (&rates, &rate);
+            max_fps = MAX (max_fps, ival.stepwise.min.denominator / ival.stepwise.min.numerator);
+            break;
+        }
+    }
+
+    if (gst_value_list_get_size (&rates) == 0)
+    {
+        gst_structure_set (structure, "framerate", GST_TYPE_FRACTION_RANGE, 0, 1, G_MAXINT, 1,
+                NULL);
+        max_fps = DEFAULT_VIDEO_FPS;
+    }
+    else if (gst_value_list_get_size (&rates) == 1)
+        gst_structure_set_value (structure, "framerate", gst_value_list_get_value (&rates, 0));
+    else
+        gst_structure_set_value (structure, "framerate", &rates);
+    g_value_unset (&rates);
+    return max_fps;
+}
+
+static gint
+gst_camsrc_compare_modes (gconstpointer a, gconstpointer b)
+{
+    const GstCamsrcMode *ma = (const GstCamsrcMode *) a;
+    const GstCamsrcMode *mb = (const GstCamsrcMode *) b;
+
+    if (ma->pixel_rate != mb->pixel_rate)
+        return ma->pixel_rate > mb->pixel_rate ? -1 : 1;
+    return ma->order < mb->order ? -1 : (ma->order > mb->order ? 1 : 0);
+}
+
+/* Asks the device for every format, frame size and frame interval it
+ * supports. Modes are ordered by pixel rate so that fixation picks the
+ * highest-throughput one when downstream does not care. */
+static GstCaps *
+gst_camsrc_probe_caps (Gstcamsrc * camsrc)
+{
+    struct v4l2_fmtdesc fmt;
+    struct v4l2_frmsizeenum size;
+    GArray *modes = g_array_new (FALSE, FALSE, sizeof (GstCamsrcMode));
+    GstStructure *format;
+    GstCamsrcMode mode;
+    GstCaps *caps;
+    int fd = -1;
+    guint index;
+
+    if (camera_hal_if_get_fd(camsrc->p_h_camera, &fd) != 0 || fd < 0)
+    {
+        g_array_free (modes, TRUE);
+        return NULL;
+    }
+
+    memset (&fmt, 0, sizeof (fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (fmt.index = 0; ioctl (fd, VIDIOC_ENUM_FMT, &fmt) == 0; fmt.index++)
+    {
+        format = gst_camsrc_format_structure (fmt.pixelformat);
+        if (format == NULL)
+            continue;
+
+        memset (&size, 0, sizeof (size));
+        size.pixel_format = fmt.pixelformat;
+        for (size.index = 0; ioctl (fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++)
+        {
+            mode.structure = gst_structure_copy (format);
+            mode.order = modes->len;
+            if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+            {
+                gst_structure_set (mode.structure,
+                        "width", G_TYPE_INT, (gint) size.discrete.width,
+                        "height", G_TYPE_INT, (gint) size.discrete.height, NULL);
+                mode.pixel_rate = (guint64) size.discrete.width * size.discrete.height *
+                    gst_camsrc_add_framerates (fd, fmt.pixelformat, size.discrete.width,
+                            size.discrete.height, mode.structure);
+                g_array_append_val (modes, mode);
+                continue;
+            }
+
+            /* stepwise or continuous, rates are taken at the largest size */
+            gst_structure_set (mode.structure,
+                    "width", GST_TYPE_INT_RANGE, (gint) size.stepwise.min_width,
+                    (gint) size.stepwise.max_width,
+                    "height", GST_TYPE_INT_RANGE, (gint) size.stepwise.min_height,
+                    (gint) size.stepwise.max_height, NULL);
+            mode.pixel_rate = (guint64) size.stepwise.max_width * size.stepwise.max_height *
+                gst_camsrc_add_framerates (fd, fmt.pixelformat, size.stepwise.max_width,
+                        size.stepwise.max_height, mode.structure);
+            g_array_append_val (modes, mode);
+            break;
+        }
+        gst_structure_free (format);
+    }
+
+    g_array_sort (modes, gst_camsrc_compare_modes);
+    caps = gst_caps_new_empty ();
+    for (index = 0; index < modes->len; index++)
+        gst_caps_append_structure (caps, g_array_index (modes, GstCamsrcMode, index).structure);
+    g_array_free (modes, TRUE);
+
+    GST_DEBUG_OBJECT (camsrc, "probed caps: %" GST_PTR_FORMAT, caps);
+    return caps;
+}
+
+static GstCaps *
+gst_camsrc_get_caps (GstBaseSrc * basesrc, GstCaps * filter)
+{
+    Gstcamsrc *camsrc = GST_CAMSRC (basesrc);
+
+    if (camsrc->probed_caps == NULL && camsrc->p_h_camera != NULL)
+    {
+        camsrc->probed_caps = gst_camsrc_probe_caps (camsrc);
+        if (camsrc->probed_caps && gst_caps_is_empty (camsrc->probed_caps))
+            gst_caps_replace (&camsrc->probed_caps, NULL);
+    }
+
+    /* before the device is open, or if it cannot be enumerated */
+    if (camsrc->probed_caps == NULL)
+        return GST_BASE_SRC_CLASS (parent_class)->get_caps (basesrc, filter);
+
+    if (filter)
+        return gst_caps_intersect_full (filter, camsrc->probed_caps, GST_CAPS_INTERSECT_FIRST);
+    return gst_caps_ref (camsrc->probed_caps);
+}
+
 static gboolean
 gst_camsrc_negotiate (GstBaseSrc * basesrc)
 {
+    Gstcamsrc *camsrc = GST_CAMSRC (basesrc);
     GstCaps *thiscaps;
+    GstCaps *caps = NULL;
     GstCaps *peercaps = NULL;
     gboolean result = FALSE;
-    const gchar * pfx = " ";
     GstStructure *pref = NULL;
-    streamformat.stream_width = DEFAULT_VIDEO_WIDTH;
-    streamformat.stream_height = DEFAULT_VIDEO_HEIGHT;
-    streamformat.pixel_format = DEFAULT_PIXEL_FORMAT;
-    streamformat.stream_fps = DEFAULT_VIDEO_FPS;
+    camsrc->streamformat.stream_width = DEFAULT_VIDEO_WIDTH;
+    camsrc->streamformat.stream_height = DEFAULT_VIDEO_HEIGHT;
+    camsrc->streamformat.pixel_format = DEFAULT_PIXEL_FORMAT;
+    camsrc->streamformat.stream_fps = DEFAULT_VIDEO_FPS;
 
     /* first see what is possible on our source pad */
     thiscaps = gst_pad_query_caps (GST_BASE_SRC_PAD (basesrc), NULL);
     GST_DEBUG_OBJECT (basesrc, "caps of src: %" GST_PTR_FORMAT, thiscaps);
 
     /* query the peer caps*/
-    peercaps = gst_pad_peer_query_caps (GST_BASE_SRC_PAD (basesrc), NULL);
+    peercaps = gst_pad_peer_query_caps (GST_BASE_SRC_PAD (basesrc), thiscaps);
     GST_DEBUG_OBJECT (basesrc, "caps of peer: %" GST_PTR_FORMAT, peercaps);
 
     if (peercaps && !gst_caps_is_any (peercaps)) {
@@ -286,18 +528,24 @@ gst_camsrc_negotiate (GstBaseSrc * basesrc)
         /* no peer or peer have ANY caps, work
          * with our own caps then */
         caps = thiscaps;
-        gst_caps_unref (thiscaps);
     }
     if (caps) {
-        /* now fixate */
-        if (!gst_caps_is_empty (caps)) {
-
-            if (peercaps && !gst_caps_is_any (peercaps))
-            {
-                pref = gst_caps_get_structure (peercaps, 0);
-                gst_structure_foreach (pref, set_value, (gpointer) pfx);
-                result = gst_base_src_set_caps (basesrc, peercaps);
-            }
+        /* now fixate, to the largest size and highest rate left open */
+        if (!gst_caps_is_empty (caps) && !gst_caps_is_any (caps)) {
+            caps = gst_caps_truncate (caps);
+            caps = gst_caps_make_writable (caps);
+            pref = gst_caps_get_structure (caps, 0);
+            gst_structure_fixate_field_nearest_int (pref, "width", G_MAXINT);
+            gst_structure_fixate_field_nearest_int (pref, "height", G_MAXINT);
+            gst_structure_fixate_field_nearest_fraction (pref, "framerate", G_MAXINT, 1);
+            caps = gst_caps_fixate (caps);
+            GST_DEBUG_OBJECT (basesrc, "fixated to: %" GST_PTR_FORMAT, caps);
+
+            pref = gst_caps_get_structure (caps, 0);
+            gst_structure_foreach (pref, set_value, &camsrc->streamformat);
+            result = gst_base_src_set_caps (basesrc, caps);
+            if (result)
+                gst_caps_replace (&camsrc->caps, caps);
         }
         gst_caps_unref (caps);
     }
@@ -306,6 +554,55 @@ gst_camsrc_negotiate (GstBaseSrc * basesrc)
     return result;
 }
 
+/* Largest frame the negotiated caps can produce */
+static guint
+gst_camsrc_frame_size (GstCaps * caps)
+{
+    GstVideoInfo info;
+    GstStructure *structure;
+    gint width = DEFAULT_VIDEO_WIDTH;
+    gint height = DEFAULT_VIDEO_HEIGHT;
+
+    if (caps == NULL || gst_caps_is_empty (caps) || gst_caps_is_any (caps))
+        return DEFAULT_VIDEO_WIDTH * DEFAULT_VIDEO_HEIGHT * 2;
+
+    if (gst_video_info_from_caps (&info, caps))
+        return GST_VIDEO_INFO_SIZE (&info);
+
+    /* compressed: a JPEG frame stays below two bytes per pixel */
+    structure = gst_caps_get_structure (caps, 0);
+    gst_structure_get_int (structure, "width", &width);
+    gst_structure_get_int (structure, "height", &height);
+    return width * height * 2;
+}
+
+/* Frames downstream holds because of the pipeline latency: the latency the
+ * pipeline was configured with, or otherwise the frame interval camsrc itself
+ * reports */
+static guint
+gst_camsrc_latency_buffers (Gstcamsrc * src)
+{
+    GstClockTime latency = GST_CLOCK_TIME_NONE;
+    GstObject *top = gst_object_ref (GST_OBJECT (src));
+    GstObject *parent;
+    gint fps = src->streamformat.stream_fps;
+
+    if (fps <= 0)
+        return 0;
+
+    while ((parent = gst_object_get_parent (top)) != NULL) {
+        gst_object_unref (top);
+        top = parent;
+    }
+    if (GST_IS_PIPELINE (top))
+        latency = gst_pipeline_get_latency (GST_PIPELINE (top));
+    gst_object_unref (top);
+
+    if (!GST_CLOCK_TIME_IS_VALID (latency))
+        return 1;
+    return (guint) gst_util_uint64_scale_int_ceil (latency, fps, GST_SECOND);
+}
+
 static gboolean
 gst_camsrc_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
 {
@@ -315,15 +612,38 @@ gst_camsrc_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
     GstAllocationParams params;
     GstStructure *config;
     guint size, min, max;
+    gboolean update = gst_query_get_n_allocation_pools (query) > 0;
 
-    if (gst_query_get_n_allocation_pools (query) > 0) {
+    gst_object_replace ((GstObject **) &src->pool, NULL);
+    if (update) {
         /* we got configuration from our peer, parse them */
         gst_query_parse_nth_allocation_pool (query, 0, &src->pool, &size, &min, &max);
     } else {
         src->pool = NULL;
-        size = DEFAULT_VIDEO_WIDTH*DEFAULT_VIDEO_HEIGHT*1.5;
-        min = 1;
-        max = 4;
+        size = 0;
+        min = 0;
+        max = 0;
+    }
+
+    /* downstream's own needs, the frames the latency keeps downstream and
+     * the frames camsrc keeps in flight */
+    size = MAX (size, gst_camsrc_frame_size (src->caps));
+    min += gst_camsrc_latency_buffers (src) + src->buffer_count;
+    if (max != 0 && max < min)
+        max = min;
+
+    if (src->mode == GST_V4L2_IO_DMABUF_EXPORT) {
+        /* frames are the HAL's dmabufs, appended to empty buffers in create();
+         * a downstream pool would preallocate system memory nobody uses */
+        gst_object_replace ((GstObject **) &src->pool, NULL);
+        size = 0;
+    }
+
+    if (src->mode == GST_V4L2_IO_USERPTR) {
+        /* every HAL slot holds one pool buffer, plus one to swap in */
+        min = MAX (min, NUM_MMAP_BUFFERS + 1);
+        if (max != 0 && max < min)
+            max = min;
     }
 
     if (src->pool == NULL) {
@@ -332,18 +652,283 @@ gst_camsrc_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
         src->pool = gst_buffer_pool_new();
     }
     config = gst_buffer_pool_get_config (src->pool);
-    gst_buffer_pool_config_set_params (config, caps, size, min, max);
+    gst_buffer_pool_config_set_params (config, src->caps, size, min, max);
+    if (src->mode == GST_V4L2_IO_USERPTR) {
+        /* USERPTR drivers commonly reject pointers that are not page aligned */
+        gst_allocation_params_init (&params);
+        params.align = getpagesize () - 1;
+        gst_buffer_pool_config_set_allocator (config, NULL, &params);
+    }
     gst_buffer_pool_set_config (src->pool, config);
 
+    /* so the base class configures the pool with the same sizing */
+    if (update)
+        gst_query_set_nth_allocation_pool (query, 0, src->pool, size, min, max);
+    else
+        gst_query_add_allocation_pool (query, src->pool, size, min, max);
+    GST_DEBUG_OBJECT (bsrc, "size %u min %u max %u", size, min, max);
+
+    ret = GST_BASE_SRC_CLASS (parent_class)->decide_allocation (bsrc, query);
 
     /* and activate */
     gst_buffer_pool_set_active (src->pool, TRUE);
     GST_DEBUG_OBJECT (bsrc, "Pool:%p %d", src->pool, __LINE__);
-
-    ret = GST_BASE_SRC_CLASS (parent_class)->decide_allocation (bsrc, query);
     return ret;
 }
 
+/* One open HAL handle. Wrapped MMAP frames point into its driver mappings,
+ * so it is only closed once the element and every lease have let go. */
+struct _GstCamsrcSession
+{
+    gint refcount;
+    void *camera;
+    gboolean streaming;
+    gint outstanding;
+};
+
+static GstCamsrcSession *
+gst_camsrc_session_new (void *camera)
+{
+    GstCamsrcSession *session = g_slice_new0 (GstCamsrcSession);
+
+    session->refcount = 1;
+    session->camera = camera;
+    return session;
+}
+
+static void
+gst_camsrc_session_unref (GstCamsrcSession * session)
+{
+    if (!g_atomic_int_dec_and_test (&session->refcount))
+        return;
+
+    camera_hal_if_close_device(session->camera);
+    camera_hal_if_deinit(session->camera);
+    g_slice_free (GstCamsrcSession, session);
+}
+
+/* Returns a frame to the HAL queue */
+static int
+gst_camsrc_queue (Gstcamsrc * camsrc, buffer_t * frame)
+{
+    int retval;
+
+    g_mutex_lock (&camsrc->hal_lock);
+    retval = camera_hal_if_release_buffer(camsrc->p_h_camera, frame);
+    g_mutex_unlock (&camsrc->hal_lock);
+    return retval;
+}
+
+typedef struct
+{
+    Gstcamsrc *camsrc;
+    GstCamsrcSession *session;
+    buffer_t frame;
+} GstCamsrcMmapLease;
+
+/* Runs when the last reference to a wrapped HAL buffer is dropped */
+static void
+gst_camsrc_release_mmap (gpointer data)
+{
+    GstCamsrcMmapLease *lease = (GstCamsrcMmapLease *) data;
+    Gstcamsrc *camsrc = lease->camsrc;
+
+    g_mutex_lock (&camsrc->hal_lock);
+    /* a buffer from a stopped capture has already been reclaimed by the HAL */
+    if (lease->session->streaming)
+        camera_hal_if_release_buffer(lease->session->camera, &lease->frame);
+    lease->session->outstanding--;
+    g_mutex_unlock (&camsrc->hal_lock);
+
+    gst_camsrc_session_unref (lease->session);
+    gst_object_unref (camsrc);
+    g_slice_free (GstCamsrcMmapLease, lease);
+}
+
+static GstBuffer *
+gst_camsrc_wrap_mmap_buffer (Gstcamsrc * camsrc, const buffer_t * frame)
+{
+    GstCamsrcMmapLease *lease = g_slice_new (GstCamsrcMmapLease);
+    GstBuffer *buffer = gst_buffer_new ();
+
+    lease->camsrc = gst_object_ref (camsrc);
+    lease->session = camsrc->session;
+    g_atomic_int_inc (&lease->session->refcount);
+    lease->frame = *frame;
+    gst_buffer_append_memory (buffer, gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+                frame->start, frame->length, 0, frame->length, lease,
+                gst_camsrc_release_mmap));
+    return buffer;
+}
+
+/* Fills USERPTR slot index with a buffer from the downstream pool. The
+ * buffer stays mapped while the HAL owns it. */
+static gboolean
+gst_camsrc_acquire_userptr (Gstcamsrc * camsrc, int index, gboolean wait)
+{
+    GstBufferPoolAcquireParams params = { 0 };
+    GstBuffer *buffer = NULL;
+
+    if (!wait)
+        params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    if (gst_buffer_pool_acquire_buffer (camsrc->pool, &buffer, &params) != GST_FLOW_OK)
+        return FALSE;
+    if (!gst_buffer_map (buffer, &camsrc->userptr_maps[index], GST_MAP_WRITE))
+    {
+        gst_buffer_unref (buffer);
+        return FALSE;
+    }
+
+    camsrc->userptr_buffers[index] = buffer;
+    camsrc->userptr_bufs[index].start = camsrc->userptr_maps[index].data;
+    camsrc->userptr_bufs[index].length = camsrc->userptr_maps[index].size;
+    camsrc->userptr_bufs[index].index = index;
+    return TRUE;
+}
+
+static GstClockTime
+gst_camsrc_monotonic_time (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return GST_TIMESPEC_TO_TIME (ts);
+}
+
+/* Dequeues a frame and records when the sensor captured it. The HAL does not
+ * pass the V4L2 timestamp on, so it is read back from the device; drivers
+ * without monotonic timestamps fall back to the dequeue time. */
+static int
+gst_camsrc_dequeue (Gstcamsrc * camsrc, buffer_t * frame)
+{
+    struct v4l2_buffer vbuf;
+    int retval;
+
+    g_mutex_lock (&camsrc->hal_lock);
+    retval = camera_hal_if_get_buffer(camsrc->p_h_camera, frame);
+    g_mutex_unlock (&camsrc->hal_lock);
+    if (retval != 0)
+        return retval;
+
+    camsrc->capture_time = gst_camsrc_monotonic_time ();
+    memset (&vbuf, 0, sizeof (vbuf));
+    vbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vbuf.index = frame->index;
+    if (camsrc->poll_fd.fd >= 0 && ioctl (camsrc->poll_fd.fd, VIDIOC_QUERYBUF, &vbuf) == 0 &&
+        (vbuf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+        (vbuf.timestamp.tv_sec != 0 || vbuf.timestamp.tv_usec != 0))
+        camsrc->capture_time = GST_TIMEVAL_TO_TIME (vbuf.timestamp);
+    return 0;
+}
+
+/* Stamps buf with the running time at which its frame was captured */
+static void
+gst_camsrc_set_timestamp (Gstcamsrc * camsrc, GstBuffer * buf)
+{
+    GstClock *clock;
+    GstClockTime now, base_time, delay;
+
+    if (camsrc->streamformat.stream_fps > 0)
+        GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (GST_SECOND, 1,
+                camsrc->streamformat.stream_fps);
+
+    clock = gst_element_get_clock (GST_ELEMENT (camsrc));
+    if (clock == NULL || !GST_CLOCK_TIME_IS_VALID (camsrc->capture_time))
+    {
+        if (clock)
+            gst_object_unref (clock);
+        return;
+    }
+
+    /* the pipeline clock need not be CLOCK_MONOTONIC, so carry over the age */
+    now = gst_clock_get_time (clock);
+    base_time = gst_element_get_base_time (GST_ELEMENT (camsrc));
+    gst_object_unref (clock);
+    delay = gst_camsrc_monotonic_time ();
+    delay = delay > camsrc->capture_time ? delay - camsrc->capture_time : 0;
+
+    if (now > base_time + delay)
+        GST_BUFFER_PTS (buf) = now - base_time - delay;
+    else
+        GST_BUFFER_PTS (buf) = 0;
+}
+
+static gboolean
+gst_camsrc_query (GstBaseSrc * bsrc, GstQuery * query)
+{
+    Gstcamsrc *camsrc = GST_CAMSRC (bsrc);
+    GstClockTime min_latency, max_latency;
+    guint queued;
+
+    if (GST_QUERY_TYPE (query) != GST_QUERY_LATENCY || camsrc->streamformat.stream_fps <= 0)
+        return GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+
+    /* a frame is pushed one interval after exposure starts, and can wait
+     * behind the rest of the driver queue */
+    queued = camsrc->mode == GST_V4L2_IO_DMABUF_EXPORT && camsrc->dma_count > 0
+        ? camsrc->dma_count : NUM_MMAP_BUFFERS;
+    min_latency = gst_util_uint64_scale_int (GST_SECOND, 1, camsrc->streamformat.stream_fps);
+    max_latency = min_latency * queued;
+    GST_DEBUG_OBJECT (camsrc, "latency min %" GST_TIME_FORMAT " max %" GST_TIME_FORMAT,
+            GST_TIME_ARGS (min_latency), GST_TIME_ARGS (max_latency));
+    gst_query_set_latency (query, TRUE, min_latency, max_latency);
+    return TRUE;
+}
+
+/* Blocks until the HAL has a frame, or until unlock() flushes the poll */
+static GstFlowReturn
+gst_camsrc_wait_frame (Gstcamsrc * camsrc)
+{
+    int fd = -1;
+    gint ret;
+
+    if (camsrc->poll_fd.fd < 0)
+    {
+        if (camera_hal_if_get_fd(camsrc->p_h_camera, &fd) != 0)
+            return GST_FLOW_ERROR;
+        camsrc->poll_fd.fd = fd;
+        gst_poll_add_fd (camsrc->poll, &camsrc->poll_fd);
+        gst_poll_fd_ctl_read (camsrc->poll, &camsrc->poll_fd, TRUE);
+    }
+
+    for (;;)
+    {
+        ret = gst_poll_wait (camsrc->poll, FRAME_WAIT_TIMEOUT);
+        if (ret > 0)
+            return GST_FLOW_OK;
+        if (ret == 0)
+        {
+            GST_WARNING_OBJECT (camsrc, "no frame from the camera for 2 seconds");
+            continue;
+        }
+        if (errno == EBUSY)
+            return GST_FLOW_FLUSHING;
+        if (errno != EINTR && errno != EAGAIN)
+        {
+            GST_ERROR_OBJECT (camsrc, "waiting for a frame failed: %s", g_strerror (errno));
+            return GST_FLOW_ERROR;
+        }
+    }
+}
+
+static gboolean
+gst_camsrc_unlock (GstBaseSrc * src)
+{
+    Gstcamsrc *camsrc = GST_CAMSRC (src);
+
+    gst_poll_set_flushing (camsrc->poll, TRUE);
+    return TRUE;
+}
+
+static gboolean
+gst_camsrc_unlock_stop (GstBaseSrc * src)
+{
+    Gstcamsrc *camsrc = GST_CAMSRC (src);
+
+    gst_poll_set_flushing (camsrc->poll, FALSE);
+    return TRUE;
+}
+
 static GstFlowReturn
 gst_camsrc_create (GstPushSrc * src, GstBuffer ** buf)
 {
@@ -352,23 +937,24 @@ gst_camsrc_create (GstPushSrc * src, GstBuffer ** buf)
     int retval = 0;
     GstMapInfo map;
     buffer_t frame_buffer = {0};
-    int check = 0;
-    int fd = 0;
     int index = 0;
     int count = 0;
-    GstBufferPoolAcquireParams params;
     GstBuffer *buffer = NULL;
+    GstMapInfo filled_map;
+    void *usrbufs = NULL;
+    gboolean wrap;
 
     /*We check if the camera is started. If camera is not started then we have
      * set format and set buffer and this will be done only once at the start*/
-    if(!bStarted)
+    if(!camsrc->started)
     {
-        retval = camera_hal_if_set_format(camsrc->p_h_camera, &streamformat);
-        retval = camera_hal_if_get_format(camsrc->p_h_camera, &streamformat);
+        retval = camera_hal_if_set_format(camsrc->p_h_camera, &camsrc->streamformat);
+        retval = camera_hal_if_get_format(camsrc->p_h_camera, &camsrc->streamformat);
         switch (camsrc->mode)
         {
             case GST_V4L2_IO_MMAP:
-                retval = camera_hal_if_set_buffer(camsrc->p_h_camera, 4, IOMODE_MMAP, NULL);
+                retval = camera_hal_if_set_buffer(camsrc->p_h_camera, NUM_MMAP_BUFFERS,
+                        IOMODE_MMAP, NULL);
                 if(retval != 0)
                   return GST_FLOW_ERROR;
 
@@ -376,7 +962,7 @@ gst_camsrc_create (GstPushSrc * src, GstBuffer ** buf)
                 if(retval != 0)
                   return GST_FLOW_ERROR;
 
-                bStarted = 1;
+                camsrc->started = TRUE;
                 break;
 
             case GST_V4L2_IO_DMABUF_EXPORT:
@@ -384,31 +970,33 @@ gst_camsrc_create (GstPushSrc * src, GstBuffer ** buf)
                 if(retval != 0)
                   return GST_FLOW_ERROR;
 
-                bStarted = 1;
-                frame_buffer.length = streamformat.buffer_size;
-                retval = camera_hal_if_get_buffer_fd(camsrc->p_h_camera,&dma_fd,&count);
-                if(retval != 0)
+                camsrc->started = TRUE;
+                frame_buffer.length = camsrc->streamformat.buffer_size;
+                retval = camera_hal_if_get_buffer_fd(camsrc->p_h_camera,camsrc->dma_fd,&count);
+                if(retval != 0 || count > NUM_BUFFERS)
                   return GST_FLOW_ERROR;
 
-                dma_alloc = gst_dmabuf_allocator_new();
-                if(dma_alloc)
+                camsrc->dma_alloc = gst_dmabuf_allocator_new();
+                if(camsrc->dma_alloc)
                 {
                     for (index = 0; index < count; index++)
                     {
-                        dma_memory[index] = gst_fd_allocator_alloc (dma_alloc, dma_fd[index],
-                                frame_buffer.length, GST_FD_MEMORY_FLAG_DONT_CLOSE);
-                        gst_memory_ref(dma_memory[index]);
+                        camsrc->dma_memory[index] = gst_fd_allocator_alloc (camsrc->dma_alloc,
+                                camsrc->dma_fd[index], frame_buffer.length,
+                                GST_FD_MEMORY_FLAG_DONT_CLOSE);
+                        gst_memory_ref(camsrc->dma_memory[index]);
                     }
+                    camsrc->dma_count = count;
                     retval = camera_hal_if_start_capture(camsrc->p_h_camera);
                     if(retval != 0)
                       return GST_FLOW_ERROR;
 
-                    retval = camera_hal_if_get_buffer(camsrc->p_h_camera,&frame_buffer);
+                    retval = gst_camsrc_dequeue(camsrc,&frame_buffer);
                     if(retval != 0)
                       return GST_FLOW_ERROR;
 
-                    if(frame_buffer.index >= 0) gst_memory_ref(dma_memory[frame_buffer.index]);
-                    retval = camera_hal_if_release_buffer(camsrc->p_h_camera, &frame_buffer);
+                    if(frame_buffer.index >= 0) gst_memory_ref(camsrc->dma_memory[frame_buffer.index]);
+                    retval = gst_camsrc_queue(camsrc, &frame_buffer);
                     if(retval != 0){
                       return GST_FLOW_ERROR;
                     }
@@ -417,79 +1005,206 @@ gst_camsrc_create (GstPushSrc * src, GstBuffer ** buf)
                 break;
 
             case GST_V4L2_IO_USERPTR:
-                /**
-                 * FIX_ME_IF_WRONG:
-                 *    Actually no USRERPTR has been implemented, because
-                 *    camsrc does not provide a way to push buffer from downstream.
-                 *    Trying USERPTR should always return ERROR.
-                 */
-                return GST_FLOW_ERROR;
+                if (camsrc->pool == NULL)
+                  return GST_FLOW_ERROR;
 
+                for (index = 0; index < NUM_MMAP_BUFFERS; index++)
+                {
+                    if (!gst_camsrc_acquire_userptr (camsrc, index, TRUE))
+                      return GST_FLOW_ERROR;
+                    if (camsrc->userptr_bufs[index].length < camsrc->streamformat.buffer_size)
+                    {
+                        GST_ERROR_OBJECT (camsrc, "pool buffers are smaller than a frame");
+                        return GST_FLOW_ERROR;
+                    }
+                }
+                usrbufs = camsrc->userptr_bufs;
+                retval = camera_hal_if_set_buffer(camsrc->p_h_camera, NUM_MMAP_BUFFERS,
+                        IOMODE_USERPTR, &usrbufs);
+                if(retval != 0)
+                  return GST_FLOW_ERROR;
+
+                retval = camera_hal_if_start_capture(camsrc->p_h_camera);
+                if(retval != 0)
+                  return GST_FLOW_ERROR;
+
+                camsrc->started = TRUE;
                 break;
 
             default:
                 break;
         }
+        g_mutex_lock (&camsrc->hal_lock);
+        camsrc->session->streaming = camsrc->started;
+        g_mutex_unlock (&camsrc->hal_lock);
     }
 
-    retval = camera_hal_if_get_fd(camsrc->p_h_camera,&fd);
-    if(retval != 0)
-      return GST_FLOW_ERROR;
+    *buf = NULL;
+    ret = gst_camsrc_wait_frame (camsrc);
+    if (ret != GST_FLOW_OK)
+      return ret;
 
-    struct pollfd fds[] = {
-        { .fd = fd, .events = POLLIN },
-    };
-    if((check = poll(fds, 1, 2000)) > 0)
+    switch (camsrc->mode)
     {
-        switch (camsrc->mode)
-        {
-            case GST_V4L2_IO_MMAP:
-                ret = GST_BASE_SRC_CLASS (parent_class)->alloc (GST_BASE_SRC (src), 0,
-                        streamformat.buffer_size, buf);
-                gst_buffer_map (*buf, &map, GST_MAP_WRITE);
-                retval = camera_hal_if_get_buffer(camsrc->p_h_camera,&frame_buffer);
-                if(retval != 0)
-                  return GST_FLOW_ERROR;
-                memcpy(map.data, frame_buffer.start, frame_buffer.length);
-                gst_buffer_unmap(*buf,&map);
-
-                retval = camera_hal_if_release_buffer(camsrc->p_h_camera, &frame_buffer);
-                if(retval != 0){
-                  return GST_FLOW_ERROR;
-                }
+        case GST_V4L2_IO_MMAP:
+            retval = gst_camsrc_dequeue(camsrc,&frame_buffer);
+            if(retval != 0)
+              return GST_FLOW_ERROR;
+
+            /* hand out the HAL buffer itself while the driver keeps enough queued */
+            g_mutex_lock (&camsrc->hal_lock);
+            wrap = camsrc->session->outstanding < NUM_MMAP_BUFFERS - MIN_QUEUED_MMAP_BUFFERS;
+            if (wrap)
+                camsrc->session->outstanding++;
+            g_mutex_unlock (&camsrc->hal_lock);
+            if (wrap)
+            {
+                *buf = gst_camsrc_wrap_mmap_buffer (camsrc, &frame_buffer);
                 break;
+            }
 
-            case GST_V4L2_IO_DMABUF_EXPORT:
+            ret = GST_BASE_SRC_CLASS (parent_class)->alloc (GST_BASE_SRC (src), 0,
+                    camsrc->streamformat.buffer_size, buf);
+            if (ret != GST_FLOW_OK)
+            {
+                gst_camsrc_queue(camsrc, &frame_buffer);
+                return ret;
+            }
+            gst_buffer_map (*buf, &map, GST_MAP_WRITE);
+            memcpy(map.data, frame_buffer.start, frame_buffer.length);
+            gst_buffer_unmap(*buf,&map);
 
-                params.flags = (GstBufferPoolAcquireFlags) GST_BUFFER_POOL_ACQUIRE_FLAG_LAST |
-                    GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
-                ret = gst_buffer_pool_acquire_buffer (camsrc->pool, &buffer, &params);
+            retval = gst_camsrc_queue(camsrc, &frame_buffer);
+            if(retval != 0){
+              return GST_FLOW_ERROR;
+            }
+            break;
 
-                if(ret == GST_FLOW_OK)
-                {
-                    retval = camera_hal_if_get_buffer(camsrc->p_h_camera,&frame_buffer);
-                    if(retval != 0)
-                      return GST_FLOW_ERROR;
+        case GST_V4L2_IO_USERPTR:
+            retval = gst_camsrc_dequeue(camsrc,&frame_buffer);
+            if(retval != 0 || frame_buffer.index < 0 || frame_buffer.index >= NUM_MMAP_BUFFERS)
+              return GST_FLOW_ERROR;
 
-                    gst_buffer_append_memory(buffer, dma_memory[frame_buffer.index]);
-                    gst_buffer_map (buffer, &map, GST_MAP_READ);
-                    *buf = buffer;
-                    gst_memory_ref(dma_memory[frame_buffer.index]);
-                    gst_buffer_unmap(buffer,&map);
-                    retval = camera_hal_if_release_buffer(camsrc->p_h_camera, &frame_buffer);
-                    if(retval != 0){
-                        return GST_FLOW_ERROR;
-                    }
+            index = frame_buffer.index;
+            buffer = camsrc->userptr_buffers[index];
+            filled_map = camsrc->userptr_maps[index];
+            camsrc->userptr_buffers[index] = NULL;
+
+            /* push the filled pool buffer itself if another one can take its slot */
+            if (gst_camsrc_acquire_userptr (camsrc, index, FALSE))
+            {
+                gst_buffer_unmap (buffer, &filled_map);
+                gst_buffer_set_size (buffer, frame_buffer.length);
+                *buf = buffer;
+            }
+            else
+            {
+                /* downstream holds the rest of the pool, keep this one queued */
+                camsrc->userptr_buffers[index] = buffer;
+                camsrc->userptr_maps[index] = filled_map;
+                ret = GST_BASE_SRC_CLASS (parent_class)->alloc (GST_BASE_SRC (src), 0,
+                        frame_buffer.length, buf);
+                if (ret != GST_FLOW_OK)
+                {
+                    gst_camsrc_queue(camsrc, &frame_buffer);
+                    return ret;
                 }
-                break;
+                gst_buffer_fill (*buf, 0, frame_buffer.start, frame_buffer.length);
+            }
 
-            default:
-                break;
-        }
+            /* the slot is queued again with whichever memory it now holds */
+            frame_buffer.start = camsrc->userptr_bufs[index].start;
+            frame_buffer.length = camsrc->userptr_bufs[index].length;
+            retval = gst_camsrc_queue(camsrc, &frame_buffer);
+            if(retval != 0){
+              return GST_FLOW_ERROR;
+            }
+            break;
+
+        case GST_V4L2_IO_DMABUF_EXPORT:
+
+            /* the dmabuf is the only memory; a pool buffer would be freed
+             * rather than reused once memory is appended to it */
+            retval = gst_camsrc_dequeue(camsrc,&frame_buffer);
+            if(retval != 0)
+              return GST_FLOW_ERROR;
+
+            buffer = gst_buffer_new ();
+            gst_buffer_append_memory(buffer, camsrc->dma_memory[frame_buffer.index]);
+            gst_buffer_map (buffer, &map, GST_MAP_READ);
+            *buf = buffer;
+            gst_memory_ref(camsrc->dma_memory[frame_buffer.index]);
+            gst_buffer_unmap(buffer,&map);
+            retval = gst_camsrc_queue(camsrc, &frame_buffer);
+            if(retval != 0){
+                return GST_FLOW_ERROR;
+            }
+            break;
+
+        default:
+            break;
     }
+
+    if (*buf)
+        gst_camsrc_set_timestamp (camsrc, *buf);
     return GST_FLOW_OK;
 }
 
+static void
+gst_camsrc_close_device (Gstcamsrc * camsrc)
+{
+    int index;
+
+    if (camsrc->p_h_camera == NULL)
+        return;
+
+    if (camsrc->poll_fd.fd >= 0)
+    {
+        gst_poll_remove_fd (camsrc->poll, &camsrc->poll_fd);
+        gst_poll_fd_init (&camsrc->poll_fd);
+    }
+
+    g_mutex_lock (&camsrc->hal_lock);
+    if (camsrc->started)
+        camera_hal_if_stop_capture(camsrc->p_h_camera);
+    camsrc->started = FALSE;
+    camsrc->session->streaming = FALSE;
+    g_mutex_unlock (&camsrc->hal_lock);
+
+    if(camsrc->mode == GST_V4L2_IO_DMABUF_EXPORT)
+    {
+        for (index = 0; index < camsrc->dma_count; index++)
+        {
+            gst_memory_unref(camsrc->dma_memory[index]);
+            camsrc->dma_memory[index] = NULL;
+        }
+        camsrc->dma_count = 0;
+        if (camsrc->dma_alloc)
+        {
+            gst_object_unref(camsrc->dma_alloc);
+            camsrc->dma_alloc = NULL;
+        }
+        camera_hal_if_destroy_dmafd(camsrc->p_h_camera);
+    }
+
+    for (index = 0; index < NUM_MMAP_BUFFERS; index++)
+    {
+        if (camsrc->userptr_buffers[index])
+        {
+            gst_buffer_unmap(camsrc->userptr_buffers[index], &camsrc->userptr_maps[index]);
+            gst_buffer_unref(camsrc->userptr_buffers[index]);
+            camsrc->userptr_buffers[index] = NULL;
+        }
+    }
+
+    /* frames still held downstream keep the mappings until they are freed */
+    gst_camsrc_session_unref (camsrc->session);
+    camsrc->session = NULL;
+    camsrc->p_h_camera = NULL;
+    gst_caps_replace (&camsrc->caps, NULL);
+    gst_caps_replace (&camsrc->probed_caps, NULL);
+}
+
 static GstStateChangeReturn
 gst_camsrc_change_state (GstPushSrc * element, GstStateChange transition)
 {
@@ -503,17 +1218,15 @@ gst_camsrc_change_state (GstPushSrc * element, GstStateChange transition)
                 /* open the device */
                 retval = camera_hal_if_init(&camsrc->p_h_camera, subsystem);
                 if(retval != 0)
-                  break;
+                  return GST_STATE_CHANGE_FAILURE;
                 retval = camera_hal_if_open_device(camsrc->p_h_camera, camsrc->device);
                 if(retval != 0)
-                  break;
-            }
-        case GST_STATE_CHANGE_READY_TO_NULL:
-            {
-                if(camsrc->mode == GST_V4L2_IO_DMABUF_EXPORT)
                 {
-                    retval = camera_hal_if_destroy_dmafd(camsrc->p_h_camera);
+                  camera_hal_if_deinit(camsrc->p_h_camera);
+                  camsrc->p_h_camera = NULL;
+                  return GST_STATE_CHANGE_FAILURE;
                 }
+                camsrc->session = gst_camsrc_session_new (camsrc->p_h_camera);
                 break;
             }
         default:
@@ -521,6 +1234,19 @@ gst_camsrc_change_state (GstPushSrc * element, GstStateChange transition)
     }
 
     ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+    if (ret == GST_STATE_CHANGE_FAILURE)
+        return ret;
+
+    switch (transition) {
+        case GST_STATE_CHANGE_READY_TO_NULL:
+            {
+                /* streaming has stopped, release this instance's device only */
+                gst_camsrc_close_device(camsrc);
+                break;
+            }
+        default:
+            break;
+    }
 
     return ret;
 }
@@ -538,6 +1264,9 @@ gst_camsrc_get_property (GObject * object, guint prop_id,
         case PROP_IOMODE:
             g_value_set_enum(value,filter->mode);
             break;
+        case PROP_BUFFER_COUNT:
+            g_value_set_uint(value,filter->buffer_count);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
             break;
@@ -72,14 +72,15 @@ GType gst_camsrc_iomode_get_type(void);
 #define DEFAULT_VIDEO_HEIGHT 480
 #define DEFAULT_PIXEL_FORMAT CAMERA_PIXEL_FORMAT_JPEG
 #define DEFAULT_VIDEO_FPS 30
+#define DEFAULT_PROP_BUFFER_COUNT 2
+#define NUM_BUFFERS 6
+#define NUM_MMAP_BUFFERS 4
+/* MMAP buffers kept queued in the driver; beyond that frames are copied */
+#define MIN_QUEUED_MMAP_BUFFERS 2
 
 typedef struct _Gstcamsrc      Gstcamsrc;
 typedef struct _GstcamsrcClass GstcamsrcClass;
-static gboolean bStarted = 0;
-const char *subsystem = "libv4l2-camera-plugin.so.1";
-const char *devname = "/dev/video0";
-static stream_format_t streamformat;
-
+typedef struct _GstCamsrcSession GstCamsrcSession;
 
 typedef enum {
           GST_V4L2_IO_MMAP          = 0,
@@ -93,10 +94,35 @@ struct _Gstcamsrc
 
   GstPad *srcpad;
   void *p_h_camera;
+  /* waits on the HAL fd; set flushing by unlock() */
+  GstPoll *poll;
+  GstPollFD poll_fd;
 
   gchar* device;
   GstV4l2IOMode mode;
   GstBufferPool *pool;
+  guint buffer_count;
+
+  /* per instance, so several cameras can stream in one process */
+  gboolean started;
+  stream_format_t streamformat;
+  GstCaps *caps;
+  /* every format, size and frame rate the device offers, best first */
+  GstCaps *probed_caps;
+  GstAllocator *dma_alloc;
+  GstMemory *dma_memory[NUM_BUFFERS];
+  int dma_fd[NUM_BUFFERS];
+  int dma_count;
+  /* the open HAL session; MMAP leases keep it open after the device closes */
+  GstCamsrcSession *session;
+  /* serializes HAL queue and dequeue, which leases reach from other threads */
+  GMutex hal_lock;
+  /* CLOCK_MONOTONIC time the last dequeued frame was captured, in ns */
+  GstClockTime capture_time;
+  /* USERPTR: downstream pool buffers currently queued to the HAL */
+  GstBuffer *userptr_buffers[NUM_MMAP_BUFFERS];
+  GstMapInfo userptr_maps[NUM_MMAP_BUFFERS];
+  buffer_t userptr_bufs[NUM_MMAP_BUFFERS];
 };
 
 struct _GstcamsrcClass
@@ -84,6 +84,15 @@ struct media_info_t {
   std::string mediaId;
 };
 
+struct capture_info_t {
+  int32_t index;
+  int32_t count;
+  std::string path;
+  std::string mediaId;
+  int64_t size;
+  bool shm;
+};
+
 struct load_param_t {
   int32_t displayPath;
   std::string videoDisplayMode;
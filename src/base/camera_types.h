@@ -59,6 +59,7 @@ typedef enum {
   CMP_NOTIFY_VIDEO_INFO,
   CMP_NOTIFY_ACTIVITY,
   CMP_NOTIFY_ACQUIRE_RESOURCE,
+  CMP_NOTIFY_CAPTURE_COMPLETED,
   CMP_NOTIFY_MAX
 } CMP_NOTIFY_TYPE_T;
 
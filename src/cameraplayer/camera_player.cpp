@@ -17,6 +17,9 @@
 #include "camera_player.h"
 #include "camshm.h"
 #include "cam_posixshm.h"
+#include "shmem_buffer_pool.h"
+#include "element_registry.h"
+#include <glib-unix.h>
 #include "parser/parser.h"
 #include <log/log.h>
 #include <sys/time.h>
@@ -30,6 +33,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <iostream>
+#include <algorithm>
+#include <cctype>
 #include <poll.h>
 #include <pthread.h>
 #include <sys/mman.h>
@@ -59,10 +64,18 @@ bool getFdReceived = false;
 bool recordingStarted = false;
 int bCallback = 1;
 GMainLoop* mainLoop = g_main_loop_new(nullptr, false);
-const int kNumOfImages = 1;
+const int kMaxNumOfImages = 100;
+const size_t kImageWriterQueueSize = 8;
+// shm snapshots are readable by the pipeline's group, for consumers running
+// under another uid, and removed after this many seconds if nobody did
+const mode_t kSnapshotShmMode = 0640;
+const int kSnapshotShmLifetimeSec = 30;
+const guint kShmemPoolMinBuffers = 2;
+const guint kShmemPoolMaxBuffers = 6;
 const std::string kFormatYUV = "YUY2";
 const std::string kFormatJPEG = "JPEG";
 const std::string kFormatI420 = "I420";
+const std::string kFormatNV12 = "NV12";
 const std::string kModePreview = "preview";
 const std::string kModeCapture = "capture";
 const std::string kModeRecord = "record";
@@ -93,6 +106,12 @@ CameraPlayer::CameraPlayer():
     display_path_idx_(0),
     num_of_images_to_capture_(0),
     num_of_captured_images_(0),
+    capture_interval_(0),
+    last_capture_pts_(GST_CLOCK_TIME_NONE),
+    capture_start_(GST_CLOCK_TIME_NONE),
+    capture_armed_(false),
+    capture_to_shm_(false),
+    capture_gate_open_(FALSE),
     uri_(""),
     memtype_(""),
     memsrc_(""),
@@ -119,6 +138,7 @@ CameraPlayer::CameraPlayer():
     preview_queue_(NULL),
     preview_video_crop_(NULL),
     tee_(NULL),
+    jpeg_tee_(NULL),
     capture_queue_(NULL),
     capture_encoder_(NULL),
     capture_sink_(NULL),
@@ -145,7 +165,7 @@ CameraPlayer::CameraPlayer():
     tee_capture_pad_(NULL),
     record_queue_pad_(NULL),
     tee_record_pad_(NULL),
-    context_{NULL,1,0,0,FALSE,NULL},
+    context_{NULL,1,0,0,FALSE,NULL,0,0,NULL,FALSE,0},
     source_info_(),
     current_state_(base::playback_state_t::STOPPED),
     bus_(NULL),
@@ -161,7 +181,15 @@ CameraPlayer::CameraPlayer():
     window_id_(""),
     camera_id_(""),
     cs_client_(nullptr),
-    shm_listener_(nullptr)
+    shm_listener_(nullptr),
+    shm_notifier_(nullptr),
+    shm_source_id_(0),
+    image_writer_(nullptr),
+    snapshot_sync_(""),
+    snapshot_direct_io_(false),
+    snapshot_shm_mode_(kSnapshotShmMode),
+    snapshot_shm_lifetime_(kSnapshotShmLifetimeSec),
+    capture_notice_id_(0)
 {
     CMP_DEBUG_PRINT(" this[%p]", this);
 }
@@ -247,7 +275,16 @@ void CameraPlayer::ParseOptionString(const std::string& options)
         display_mode_ = parsed["options"]["option"]["videoDisplayMode"].asString();
     }
     if (parsed["options"]["option"].hasKey("format")) {
-        format_ = parsed["options"]["option"]["format"].asString();
+        // raw sources may be YUY2, NV12 or I420; "YU12" is I420's fourcc
+        std::string format = parsed["options"]["option"]["format"].asString();
+        std::transform(format.begin(), format.end(), format.begin(), ::toupper);
+        if (format == "YU12")
+            format = kFormatI420;
+        if (format == kFormatYUV || format == kFormatNV12 || format == kFormatI420 ||
+            format == kFormatJPEG)
+            format_ = format;
+        else
+            CMP_DEBUG_PRINT("format %s is not supported", format.c_str());
     }
     if (parsed["options"]["option"].hasKey("width")) {
         width_ = parsed["options"]["option"]["width"].asNumber<int>();
@@ -270,6 +307,23 @@ void CameraPlayer::ParseOptionString(const std::string& options)
     if (parsed["options"]["option"].hasKey("cameraId")) {
         camera_id_ = parsed["options"]["option"]["cameraId"].asString();
     }
+    if (parsed["options"]["option"].hasKey("armedCapture")) {
+        capture_armed_ = parsed["options"]["option"]["armedCapture"].asBool();
+    }
+    if (parsed["options"]["option"].hasKey("snapshotSync")) {
+        snapshot_sync_ = parsed["options"]["option"]["snapshotSync"].asString();
+    }
+    if (parsed["options"]["option"].hasKey("snapshotDirectIO")) {
+        snapshot_direct_io_ = parsed["options"]["option"]["snapshotDirectIO"].asBool();
+    }
+    if (parsed["options"]["option"].hasKey("snapshotShmMode")) {
+        // octal string such as "0640"
+        snapshot_shm_mode_ = strtol(parsed["options"]["option"]["snapshotShmMode"].asString().c_str(),
+                                    nullptr, 8) & 0666;
+    }
+    if (parsed["options"]["option"].hasKey("snapshotShmLifetime")) {
+        snapshot_shm_lifetime_ = parsed["options"]["option"]["snapshotShmLifetime"].asNumber<int>();
+    }
 
     CMP_DEBUG_PRINT("uri: %s, display-path: %d, window_id: %s, display_mode: %s",
             uri_.c_str(), display_path_, window_id_.c_str(), display_mode_.c_str());
@@ -426,6 +480,8 @@ bool CameraPlayer::Load(const std::string& str)
             if (cs_client_)
             {
                 CMP_DEBUG_PRINT("cs_client_ creation OK");
+                // SIGUSR1 only wakes ShmemNotifier on rings whose writer
+                // does not wake readers itself
                 int pid = -1;
                 shm_listener_ = new SignalListener();
                 CMP_DEBUG_PRINT("shm_listener_ : %p", shm_listener_);
@@ -454,13 +510,7 @@ bool CameraPlayer::Load(const std::string& str)
                         cs_client_->close();
                         delete cs_client_;
                         cs_client_ = nullptr;
-                        if (shm_listener_)
-                        {
-                            shm_listener_->setTimeout(0, 100000);
-                            shm_listener_->quit();
-                            delete shm_listener_;
-                            shm_listener_ = nullptr;
-                        }
+                        StopSignalListener();
                     }
                 }
                 else
@@ -468,13 +518,7 @@ bool CameraPlayer::Load(const std::string& str)
                     CMP_DEBUG_PRINT("Invalid cameraId");
                     delete cs_client_;
                     cs_client_ = nullptr;
-                    if (shm_listener_)
-                    {
-                        shm_listener_->setTimeout(0, 100000);
-                        shm_listener_->quit();
-                        delete shm_listener_;
-                        shm_listener_ = nullptr;
-                    }
+                    StopSignalListener();
                 }
             }
         }
@@ -548,7 +592,9 @@ void CameraPlayer::PauseInternalSync()
     GstStateChangeReturn status = gst_element_get_state(pipeline_, &state, &pending, -1);
     CMP_DEBUG_PRINT("Status of pipeline state change to pause = %d", status);
 
-    if ( (GST_STATE_CHANGE_SUCCESS == status) && (GST_STATE_PAUSED == state) )
+    // a live source reaches PAUSED without prerolling
+    if ( (GST_STATE_CHANGE_SUCCESS == status || GST_STATE_CHANGE_NO_PREROLL == status) &&
+         (GST_STATE_PAUSED == state) )
         CMP_DEBUG_PRINT("Pipeline state change to PAUSE is success");
     else
         CMP_DEBUG_PRINT("Pipeline state change to PAUSE is filed");
@@ -578,9 +624,67 @@ bool CameraPlayer::Unload()
         usleep(500 * 1000);
     }
 
+    if (shm_source_id_)
+    {
+        g_source_remove(shm_source_id_);
+        shm_source_id_ = 0;
+    }
+    if (shm_notifier_)
+    {
+        shm_notifier_->stop();
+        delete shm_notifier_;
+        shm_notifier_ = nullptr;
+    }
+    g_atomic_int_set(&context_.needData, FALSE);
+    context_.firstSeq = 0;
+    context_.timestamp = 0;
+
+    if (context_.bufferPool)
+        gst_buffer_pool_set_flushing(context_.bufferPool, TRUE);
+
     gst_element_set_state(pipeline_, GST_STATE_NULL);
+
+    if (capture_armed_ && tee_capture_pad_)
+    {
+        // the branch elements go with the pipeline, only our pad refs remain
+        g_atomic_int_set(&capture_gate_open_, FALSE);
+        gst_element_release_request_pad(CaptureTee(), tee_capture_pad_);
+        gst_object_unref(tee_capture_pad_);
+        tee_capture_pad_ = NULL;
+        gst_object_unref(capture_queue_pad_);
+        capture_queue_pad_ = NULL;
+        capture_queue_ = capture_encoder_ = capture_sink_ = NULL;
+        num_of_images_to_capture_ = num_of_captured_images_ = 0;
+    }
+
     gst_object_unref(GST_OBJECT(pipeline_));
     pipeline_ = NULL;
+    jpeg_tee_ = NULL;
+
+    if (image_writer_)
+    {
+        // writes the images still queued before returning
+        image_writer_->stop();
+        delete image_writer_;
+        image_writer_ = nullptr;
+    }
+    {
+        // deliver what the writer reported while draining, not after unload
+        std::lock_guard<std::mutex> lock(capture_notice_lock_);
+        if (capture_notice_id_ != 0)
+        {
+            g_source_remove(capture_notice_id_);
+            capture_notice_id_ = 0;
+        }
+    }
+    NotifyCaptures(this);
+
+    if (context_.bufferPool)
+    {
+        gst_buffer_pool_set_active(context_.bufferPool, FALSE);
+        gst_object_unref(context_.bufferPool);
+        context_.bufferPool = NULL;
+    }
 
     SetPlayerState(base::playback_state_t::STOPPED);
 
@@ -594,7 +698,17 @@ bool CameraPlayer::Unload()
     }
     else if (memtype_ == kMemtypePosixShm)
     {
-        //[TODO] We need POSIX shared memory name.
+        if (ClosePosixShmem((SHMEM_HANDLE *)(&(context_.shmemHandle))) != POSHMEM_COMM_OK)
+        {
+            CMP_DEBUG_PRINT("ClosePosixShmem failed");
+            return false;
+        }
+        // the mapping does not need the fd; a new one is received on each Load
+        if (posixshm_fd != -1)
+        {
+            close(posixshm_fd);
+            posixshm_fd = -1;
+        }
     }
 
     if (!detachSurface())
@@ -614,6 +728,13 @@ bool CameraPlayer::Unload()
         cs_client_ = nullptr;
     }
 
+    StopSignalListener();
+
+    return true;
+}
+
+void CameraPlayer::StopSignalListener()
+{
     if (shm_listener_)
     {
         shm_listener_->setTimeout(0, 100000);
@@ -621,8 +742,6 @@ bool CameraPlayer::Unload()
         delete shm_listener_;
         shm_listener_ = nullptr;
     }
-
-    return true;
 }
 
 bool CameraPlayer::Play()
@@ -647,14 +766,60 @@ bool CameraPlayer::Play()
     return true;
 }
 
-bool CameraPlayer::TakeSnapshot(const std::string& location)
+bool CameraPlayer::TakeSnapshot(const std::string& location, int count, int interval,
+                                bool shm)
 {
-    CMP_DEBUG_PRINT(" CameraPlayer::TakeSnapshot location:%s\n ",location.c_str());
+    CMP_DEBUG_PRINT(" CameraPlayer::TakeSnapshot location:%s count:%d interval:%d shm:%d\n ",
+            location.c_str(), count, interval, shm);
+
+    if (capture_armed_ ? g_atomic_int_get(&capture_gate_open_) : capture_queue_ != NULL)
+    {
+        CMP_DEBUG_PRINT("capture of %d images still in progress", num_of_images_to_capture_);
+        return false;
+    }
+    if (count < 1 || count > kMaxNumOfImages || interval < 0)
+    {
+        CMP_DEBUG_PRINT("invalid burst, count %d interval %d", count, interval);
+        return false;
+    }
+    if (!StartImageWriter())
+        return false;
 
     if (!location.empty())
         capture_path_ = location;
+    capture_to_shm_ = shm;
+    num_of_images_to_capture_ = count;
+    num_of_captured_images_ = 0;
+    capture_interval_ = interval * GST_MSECOND;
+    last_capture_pts_ = GST_CLOCK_TIME_NONE;
 
-    tee_capture_pad_ = gst_element_get_request_pad(tee_, "src_%u");
+    if (capture_armed_)
+    {
+        if (!tee_capture_pad_)
+        {
+            CMP_DEBUG_PRINT("armed capture branch is not linked");
+            return false;
+        }
+        // frames already queued behind the gate predate this request
+        capture_start_ = GST_CLOCK_TIME_NONE;
+        if (memtype_ == kMemtypeShmem || memtype_ == kMemtypePosixShm)
+        {
+            capture_start_ = ShmemCaptureStart();
+        }
+        else
+        {
+            GstClock *clock = gst_element_get_clock(pipeline_);
+            if (clock)
+            {
+                capture_start_ = gst_clock_get_time(clock) - gst_element_get_base_time(pipeline_);
+                gst_object_unref(clock);
+            }
+        }
+        g_atomic_int_set(&capture_gate_open_, TRUE);
+        return true;
+    }
+
+    tee_capture_pad_ = gst_element_get_request_pad(CaptureTee(), "src_%u");
     if (tee_capture_pad_ == NULL)
     {
         CMP_DEBUG_PRINT("tee_capture_pad_ is NULL\n");
@@ -716,10 +881,38 @@ bool CameraPlayer::StartRecord(const std::string& location, const std::string& f
         return false;
     }
     recordingStarted = true;
+    SetShmemReaderLossless(true);
     event_lock_.unlock();
     return true;
 }
 
+// While recording, ask the producer not to overwrite frames we have not read
+// yet. Whether it waits or drops depends on the overflow policy it set.
+void CameraPlayer::SetShmemReaderLossless(bool lossless)
+{
+    SHMEM_READER_MODE_T mode = lossless ? SHMEM_READER_LOSSLESS : SHMEM_READER_LATEST;
+    SHMEM_STATS_T stats;
+    bool ok = false;
+
+    if (memtype_ == kMemtypeShmem)
+        ok = SetShmemReaderMode(context_.shmemHandle, mode) == SHMEM_COMM_OK
+                && GetShmemStats(context_.shmemHandle, &stats) == SHMEM_COMM_OK;
+    else if (memtype_ == kMemtypePosixShm)
+        ok = SetPosixShmemReaderMode(context_.shmemHandle, mode) == POSHMEM_COMM_OK
+                && GetPosixShmemStats(context_.shmemHandle, &stats) == POSHMEM_COMM_OK;
+    else
+        return;
+
+    if (!ok)
+    {
+        CMP_DEBUG_PRINT("producer does not support lossless delivery");
+        return;
+    }
+    CMP_DEBUG_PRINT("lossless %d: written %llu, dropped %llu, overwritten %llu, "
+                    "blocked %llu, timeouts %llu", lossless, stats.written, stats.dropped,
+                    stats.overwritten, stats.blocked, stats.timeouts);
+}
+
 bool CameraPlayer::StopRecord()
 {
     // if already stopped, avoid execution
@@ -902,19 +1095,35 @@ void CameraPlayer::SetGstreamerDebug()
     }
 }
 
-void CameraPlayer::WriteImageToFile(const void *p,int size)
+std::string CameraPlayer::MakeImagePath()
 {
-    CMP_DEBUG_PRINT("CameraPlayer::WriteImageToFile capture_path_=%s",capture_path_.c_str());
+    CMP_DEBUG_PRINT("CameraPlayer::MakeImagePath capture_path_=%s",capture_path_.c_str());
+    if (capture_to_shm_)
+    {
+        static gint shm_images = 0;
+        char shm_name[64] = {};
+        snprintf(shm_name, sizeof(shm_name), "/cmp-snapshot-%d-%d", getpid(),
+                g_atomic_int_add(&shm_images, 1));
+        return std::string(shm_name);
+    }
+
     if (capture_path_.empty())
     {
         CMP_DEBUG_PRINT("capture_path_ empty");
         capture_path_ = std::string(kCaptureImagePath);
     }
 
-    std::size_t pos = capture_path_.rfind('.');
-    if (pos != std::string::npos)
+    // images of a burst are numbered so they do not overwrite each other
+    char image_index[16] = {};
+    if (num_of_images_to_capture_ > 1)
+        snprintf(image_index, sizeof(image_index), "_%03d", num_of_captured_images_ + 1);
+
+    std::string path = capture_path_;
+    std::size_t pos = path.rfind('.');
+    if (pos != std::string::npos && path.find('/', pos) == std::string::npos)
     {
         CMP_DEBUG_PRINT("capture_path_ is with file name ");
+        path.insert(pos, image_index);
     }
     else
     {
@@ -926,24 +1135,72 @@ void CameraPlayer::WriteImageToFile(const void *p,int size)
         gettimeofday(&tmnow_, NULL);
 
         char image_name[100] = {};
-        snprintf(image_name, 100, "Capture%02d%02d%02d-%02d%02d%02d%02d.jpeg", timePtr_->tm_mday,
+        snprintf(image_name, 100, "Capture%02d%02d%02d-%02d%02d%02d%02d%s.jpeg", timePtr_->tm_mday,
                 (timePtr_->tm_mon) + 1, (timePtr_->tm_year) + 1900, (timePtr_->tm_hour),
-                (timePtr_->tm_min), (timePtr_->tm_sec), ((int)tmnow_.tv_usec) / 10000);
-        CMP_DEBUG_PRINT("writeImageToFile image_name : %s\n", image_name);
+                (timePtr_->tm_min), (timePtr_->tm_sec), ((int)tmnow_.tv_usec) / 10000,
+                image_index);
+        CMP_DEBUG_PRINT("MakeImagePath image_name : %s\n", image_name);
 
-        capture_path_ = capture_path_ + image_name;
+        path = path + image_name;
     }
-    CMP_DEBUG_PRINT("writeImageToFile path : %s\n", capture_path_.c_str());
+    CMP_DEBUG_PRINT("MakeImagePath path : %s\n", path.c_str());
+    return path;
+}
+
+// Called on the writer thread. Notifications are only sent from the main
+// loop, so the result is handed over to it.
+void CameraPlayer::QueueCaptureNotice(const base::capture_info_t &info)
+{
+    std::lock_guard<std::mutex> lock(capture_notice_lock_);
+    capture_notices_.push_back(info);
+    if (capture_notice_id_ == 0)
+        capture_notice_id_ = g_idle_add(NotifyCaptures, this);
+}
 
-    FILE *fp = fopen(capture_path_.c_str(), "wb");
-    if (NULL == fp)
+gboolean CameraPlayer::NotifyCaptures(gpointer gdata)
+{
+    CameraPlayer *player = reinterpret_cast<CameraPlayer *>(gdata);
+    std::deque<base::capture_info_t> notices;
     {
-        CMP_DEBUG_PRINT("File %s Open Failed", capture_path_.c_str());
-        return;
+        std::lock_guard<std::mutex> lock(player->capture_notice_lock_);
+        notices.swap(player->capture_notices_);
+        player->capture_notice_id_ = 0;
     }
-    CMP_DEBUG_PRINT("File Open Success");
-    fwrite(p, size, 1, fp);
-    fclose(fp);
+    for (auto &info : notices)
+    {
+        if (player->cbFunction_)
+            player->cbFunction_(CMP_NOTIFY_CAPTURE_COMPLETED, info.index, info.path.c_str(),
+                                &info);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+bool CameraPlayer::StartImageWriter()
+{
+    if (image_writer_)
+        return true;
+
+    image_writer_ = new ImageWriter(kImageWriterQueueSize,
+            ImageWriter::toSyncPolicy(snapshot_sync_), snapshot_direct_io_,
+            [this](const ImageWriter::Image &image, bool written) {
+                base::capture_info_t info = {};
+                info.index = image.index;
+                info.count = image.count;
+                info.path  = written ? image.path : std::string();
+                info.size  = written ? gst_buffer_get_size(image.buffer) : 0;
+                info.shm   = image.shm;
+                QueueCaptureNotice(info);
+            });
+    image_writer_->setShmPolicy(snapshot_shm_mode_,
+            std::chrono::seconds(std::max(snapshot_shm_lifetime_, 1)));
+    if (!image_writer_->start())
+    {
+        CMP_DEBUG_PRINT("image writer start failed");
+        delete image_writer_;
+        image_writer_ = nullptr;
+        return false;
+    }
+    return true;
 }
 
 bool CameraPlayer::GetSourceInfo()
@@ -990,7 +1247,8 @@ bool CameraPlayer::LoadPipeline()
             return false;
         }
         g_object_set(source_, "device", memsrc_.c_str(), NULL);
-        g_object_set(source_, "do-timestamp", true, NULL);
+        // camsrc stamps buffers with the sensor capture time itself
+        g_object_set(source_, "do-timestamp", false, NULL);
         g_object_set(source_, "iomode", iomode_, NULL);
     }
     else if (memtype_ == kMemtypeShmem)
@@ -1010,7 +1268,10 @@ bool CameraPlayer::LoadPipeline()
         }
         g_object_set(source_, "format", GST_FORMAT_TIME, NULL);
         g_object_set(source_, "do-timestamp", true, NULL);
+        if (!SetupShmemBufferPool(false) || !StartShmemNotifier(false))
+            return false;
         g_signal_connect(source_, "need-data", G_CALLBACK (FeedData), this);
+        g_signal_connect(source_, "enough-data", G_CALLBACK (EnoughData), this);
     }
     else if (memtype_ == kMemtypePosixShm)
     {
@@ -1028,7 +1289,10 @@ bool CameraPlayer::LoadPipeline()
         }
         g_object_set(source_, "format", GST_FORMAT_TIME, NULL);
         g_object_set(source_, "do-timestamp", true, NULL);
-        g_signal_connect(source_, "need-data", G_CALLBACK (FeedPosixData), this);
+        if (!SetupShmemBufferPool(true) || !StartShmemNotifier(true))
+            return false;
+        g_signal_connect(source_, "need-data", G_CALLBACK (FeedData), this);
+        g_signal_connect(source_, "enough-data", G_CALLBACK (EnoughData), this);
     }
     else
     {
@@ -1043,11 +1307,11 @@ bool CameraPlayer::LoadPipeline()
         return false;
     }
 
-    if (format_ == kFormatYUV)
+    if (IsRawFormat())
     {
-        if (!LoadYUY2Pipeline())
+        if (!LoadRawPipeline())
         {
-            CMP_DEBUG_PRINT("YUY2 pipeline_ load failed!");
+            CMP_DEBUG_PRINT("%s pipeline_ load failed!", format_.c_str());
             return false;
         }
     }
@@ -1063,12 +1327,57 @@ bool CameraPlayer::LoadPipeline()
         CMP_DEBUG_PRINT("Format[%s] not Supported", format_.c_str());
     }
 
-    return gst_element_set_state(pipeline_, GST_STATE_PAUSED);
+    if (capture_armed_ && !ArmCaptureBranch())
+    {
+        CMP_DEBUG_PRINT("armed capture branch failed, snapshots build their own branch");
+        capture_armed_ = false;
+    }
+
+    GstStateChangeReturn ret = gst_element_set_state(pipeline_, GST_STATE_PAUSED);
+    if (ret == GST_STATE_CHANGE_FAILURE)
+        return false;
+
+    // camsrc is live and does not preroll, so no ASYNC_DONE reports the load
+    if (ret == GST_STATE_CHANGE_NO_PREROLL && !load_complete_)
+    {
+        if (cbFunction_)
+            cbFunction_(CMP_NOTIFY_LOAD_COMPLETED, 0, nullptr, nullptr);
+        load_complete_ = true;
+    }
+    return true;
+}
+
+// Leaves the format to the sink, so vconv_ only converts when the sink cannot
+// show the source format; only the size is fixed when scaling down.
+GstCaps *CameraPlayer::CreatePreviewCaps() const
+{
+    GstCaps *caps = gst_caps_from_string("video/x-raw(memory:DMABuf); video/x-raw");
+
+    if (width_ > WINDOW_MAX_WIDTH || height_ > WINDOW_MAX_HEIGHT)
+    {
+        gst_caps_set_simple(caps,
+                "width", G_TYPE_INT, WINDOW_MAX_WIDTH,
+                "height", G_TYPE_INT, WINDOW_MAX_HEIGHT,
+                NULL);
+    }
+    return caps;
+}
+
+// The platform's "video-converter" may be limited to a maximum resolution
+// in gst_elements.conf; larger streams fall back to videoconvert.
+GstElement *CameraPlayer::CreateVideoConverter(const char *name) const
+{
+    const ElementRegistry &registry = ElementRegistry::instance();
+    GstElement *element = registry.make("video-converter", "videoconvert", name,
+                                        width_, height_);
+    registry.configure("video-converter", element);
+    return element;
 }
 
 bool CameraPlayer::CreatePreviewBin(GstPad * pad)
 {
-    vconv_ = gst_element_factory_make("videoconvert", "vconv");
+    const ElementRegistry &registry = ElementRegistry::instance();
+    vconv_ = CreateVideoConverter("vconv");
     if (!vconv_)
     {
         CMP_DEBUG_PRINT("vconv_(%p) Failed", vconv_);
@@ -1083,10 +1392,6 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
         return false;
     }
 #endif
-    // Removing v4l2convert as it is failing for higher resolutions,
-    // if in future any performance issue comes we will add this
-    // element for lower resolution.
-
     if(width_ > WINDOW_MAX_WIDTH || height_ > WINDOW_MAX_HEIGHT)
     {
         CMP_DEBUG_PRINT("videoscale is needed.\n");
@@ -1098,7 +1403,7 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
         }
     }
 
-    preview_sink_ = gst_element_factory_make("waylandsink", "preview-sink");
+    preview_sink_ = registry.make("video-sink", "waylandsink", "preview-sink");
     if (!preview_sink_)
     {
         CMP_DEBUG_PRINT("preview_sink_ element creation failed.");
@@ -1110,7 +1415,7 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
             g_object_set(G_OBJECT(preview_sink_), "sync", false, NULL);
         else
         {
-            if (shm_listener_)
+            if (cs_client_)
                 g_object_set(G_OBJECT(preview_sink_), "sync", false, NULL);
             else
                 g_object_set(G_OBJECT(preview_sink_), "sync", true, NULL);
@@ -1118,7 +1423,7 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
     }
     else
     {
-        if (shm_listener_)
+        if (cs_client_)
         {
             // apply to both system V and POSIX shmem
             g_object_set(G_OBJECT(preview_sink_), "sync", false, NULL);
@@ -1134,6 +1439,7 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
 #ifndef PLATFORM_QEMUX86
     g_object_set(G_OBJECT(preview_sink_), "use-drmbuf", false, NULL);
 #endif
+    registry.configure("video-sink", preview_sink_);
 
     if (!gst_bin_add(GST_BIN(pipeline_), preview_sink_))
     {
@@ -1160,20 +1466,7 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
             CMP_DEBUG_PRINT("filter_ element creation failed.");
             return false;
         }
-        if(width_ > WINDOW_MAX_WIDTH || height_ > WINDOW_MAX_HEIGHT)
-        {
-            caps_RGB_ = gst_caps_new_simple("video/x-raw",
-                "width", G_TYPE_INT, WINDOW_MAX_WIDTH,
-                "height", G_TYPE_INT, WINDOW_MAX_HEIGHT,
-                "format", G_TYPE_STRING, "RGB16",
-                NULL);
-        }
-        else
-        {
-            caps_RGB_ = gst_caps_new_simple("video/x-raw",
-                    "format", G_TYPE_STRING, "RGB16",
-                    NULL);
-        }
+        caps_RGB_ = CreatePreviewCaps();
         g_object_set(G_OBJECT(filter_RGB_), "caps", caps_RGB_, NULL);
         if(preview_scale_)
         {
@@ -1242,20 +1535,7 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
             CMP_DEBUG_PRINT("filter_ element creation failed.");
             return false;
         }
-        if(width_ > WINDOW_MAX_WIDTH || height_ > WINDOW_MAX_HEIGHT)
-        {
-            caps_RGB_ = gst_caps_new_simple("video/x-raw",
-                "width", G_TYPE_INT, WINDOW_MAX_WIDTH,
-                "height", G_TYPE_INT, WINDOW_MAX_HEIGHT,
-                "format", G_TYPE_STRING, "RGB16",
-                NULL);
-        }
-        else
-        {
-            caps_RGB_ = gst_caps_new_simple("video/x-raw",
-                    "format", G_TYPE_STRING, "RGB16",
-                    NULL);
-        }
+        caps_RGB_ = CreatePreviewCaps();
         g_object_set(G_OBJECT(filter_RGB_), "caps", caps_RGB_, NULL);
 
 #endif
@@ -1311,7 +1591,6 @@ bool CameraPlayer::CreatePreviewBin(GstPad * pad)
 bool CameraPlayer::CreateCaptureElements(GstPad* tee_capture_pad)
 {
     CMP_DEBUG_PRINT(" CameraPlayer::CreateCaptureElements \n ");
-    num_of_images_to_capture_ = kNumOfImages;
 
     capture_queue_ = gst_element_factory_make("queue", "capture-queue");
     if (!capture_queue_)
@@ -1341,31 +1620,43 @@ bool CameraPlayer::CreateCaptureElements(GstPad* tee_capture_pad)
     }
     CMP_DEBUG_PRINT(" CameraPlayer::CreateCaptureElements, capture queue pad done \n ");
 
-    if (!capture_encoder_)
+    // frames tapped before the decoder are JPEG already
+    if (jpeg_tee_)
     {
-        capture_encoder_ = gst_element_factory_make("jpegenc",
-                "capture-encoder");
-        if (!capture_encoder_)
+        if (TRUE != gst_element_link(capture_queue_, capture_sink_))
         {
-            CMP_DEBUG_PRINT("capture_encoder_(%p) Failed", capture_encoder_);
+            CMP_DEBUG_PRINT("Elements could not be linked.\n");
             return false;
         }
     }
-    CMP_DEBUG_PRINT(" CameraPlayer::CreateCaptureElements,capture_encoder done  \n ");
-
-    if (TRUE != gst_bin_add(GST_BIN(pipeline_), capture_encoder_))
+    else
     {
-        CMP_DEBUG_PRINT("Element capture_encoder_ could not be added. \n");
-        return false;
-    }
+        if (!capture_encoder_)
+        {
+            capture_encoder_ = gst_element_factory_make("jpegenc",
+                    "capture-encoder");
+            if (!capture_encoder_)
+            {
+                CMP_DEBUG_PRINT("capture_encoder_(%p) Failed", capture_encoder_);
+                return false;
+            }
+        }
+        CMP_DEBUG_PRINT(" CameraPlayer::CreateCaptureElements,capture_encoder done  \n ");
 
-    if (TRUE != gst_element_link_many(capture_queue_, capture_encoder_,
-                capture_sink_, NULL))
-    {
-        CMP_DEBUG_PRINT("Elements could not be linked.\n");
-        return false;
+        if (TRUE != gst_bin_add(GST_BIN(pipeline_), capture_encoder_))
+        {
+            CMP_DEBUG_PRINT("Element capture_encoder_ could not be added. \n");
+            return false;
+        }
+
+        if (TRUE != gst_element_link_many(capture_queue_, capture_encoder_,
+                    capture_sink_, NULL))
+        {
+            CMP_DEBUG_PRINT("Elements could not be linked.\n");
+            return false;
+        }
+        CMP_DEBUG_PRINT(" CameraPlayer::CreateCaptureElements, elements linked \n ");
     }
-    CMP_DEBUG_PRINT(" CameraPlayer::CreateCaptureElements, elements linked \n ");
 
     if (GST_PAD_LINK_OK != gst_pad_link(tee_capture_pad, capture_queue_pad_))
     {
@@ -1385,7 +1676,7 @@ bool CameraPlayer::CreateCaptureElements(GstPad* tee_capture_pad)
     }
     CMP_DEBUG_PRINT(" CameraPlayer::CreateCaptureElementsi, sync with parents done\n ");
 
-    if (TRUE != gst_element_sync_state_with_parent(capture_encoder_))
+    if (capture_encoder_ && TRUE != gst_element_sync_state_with_parent(capture_encoder_))
     {
         CMP_DEBUG_PRINT("Sync state capture_encoder_ failed");
         return false;
@@ -1395,6 +1686,40 @@ bool CameraPlayer::CreateCaptureElements(GstPad* tee_capture_pad)
     return true;
 }
 
+// Links the capture branch once at load time. The gate probe drops every
+// buffer until TakeSnapshot opens it, so a snapshot costs no graph changes.
+bool CameraPlayer::ArmCaptureBranch()
+{
+    tee_capture_pad_ = gst_element_get_request_pad(CaptureTee(), "src_%u");
+    if (tee_capture_pad_ == NULL)
+    {
+        CMP_DEBUG_PRINT("tee_capture_pad_ is NULL\n");
+        return false;
+    }
+    gst_pad_add_probe(tee_capture_pad_, GST_PAD_PROBE_TYPE_BUFFER,
+            CaptureGateProbe, this, NULL);
+
+    if (!CreateCaptureElements(tee_capture_pad_))
+    {
+        CMP_DEBUG_PRINT("CreateCaptureElements Failed.\n");
+        gst_element_release_request_pad(CaptureTee(), tee_capture_pad_);
+        gst_object_unref(tee_capture_pad_);
+        tee_capture_pad_ = NULL;
+        FreeCaptureElements();
+        return false;
+    }
+    // the sink sees no buffer until the first snapshot, it must not hold preroll
+    g_object_set(G_OBJECT(capture_sink_), "async", FALSE, NULL);
+    return true;
+}
+
+// In JPEG mode snapshots tap the camera's own JPEG frames ahead of the
+// decoder, so nothing is decoded or re-encoded for them.
+GstElement *CameraPlayer::CaptureTee() const
+{
+    return jpeg_tee_ ? jpeg_tee_ : tee_;
+}
+
 bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
                                         GstPad* record_audio_encoder_pad,
                                         const std::string& fileFormat)
@@ -1413,7 +1738,7 @@ bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
     struct timeval tmnow_;
     gettimeofday(&tmnow_, NULL);
 
-    if (format_ == kFormatYUV && memtype_ != kMemtypeShmem)
+    if (IsRawFormat() && memtype_ != kMemtypeShmem)
     {
         record_queue_ = gst_element_factory_make ("queue", "record-queue");
         if (!record_queue_)
@@ -1431,16 +1756,18 @@ bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
     }
     g_object_set(G_OBJECT(record_video_queue_), "max-size-time", 700, NULL);
 
+    const ElementRegistry &registry = ElementRegistry::instance();
 #ifdef PLATFORM_QEMUX86
-    record_encoder_ = gst_element_factory_make ("avenc_mjpeg", "record-encoder");
+    record_encoder_ = registry.make("video-encoder", "avenc_mjpeg", "record-encoder");
 #else
-    record_encoder_ = gst_element_factory_make ("v4l2h264enc", "record-encoder");
+    record_encoder_ = registry.make("video-encoder", "v4l2h264enc", "record-encoder");
 #endif
     if (!record_encoder_)
     {
         CMP_DEBUG_PRINT("record_encoder_(%p) Failed", record_encoder_);
         return false;
     }
+    registry.configure("video-encoder", record_encoder_);
 #ifndef PLATFORM_QEMUX86
     filter_H264_ = gst_element_factory_make("capsfilter", "filter-h264");
     if (!filter_H264_)
@@ -1459,12 +1786,12 @@ bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
         CMP_DEBUG_PRINT("filter_ element creation failed.");
         return false;
     }
-    caps_NV12_ = gst_caps_new_simple("video/x-raw",
-            "format", G_TYPE_STRING, "NV12",
-            NULL);
+    // record_convert_ passes through when the source is already in a format
+    // the encoder takes, so NV12 and I420 sources are not converted
+    caps_NV12_ = gst_caps_from_string("video/x-raw, format=(string){ NV12, I420 }");
     g_object_set(G_OBJECT(filter_NV12_), "caps", caps_NV12_, NULL);
 #endif
-    record_convert_ = gst_element_factory_make("videoconvert", "record-convert");
+    record_convert_ = CreateVideoConverter("record-convert");
     if (!record_convert_)
     {
         CMP_DEBUG_PRINT("record_convert_(%p) Failed", record_convert_);
@@ -1508,7 +1835,7 @@ bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
         return false;
     }
     g_object_set(G_OBJECT(record_sink_), "location", recordfilename, NULL);
-    if(memtype_ == kMemtypeShmem && format_ == kFormatYUV)
+    if(memtype_ == kMemtypeShmem && IsRawFormat())
         g_object_set(G_OBJECT(record_sink_), "sync", false, NULL);
     else
         g_object_set(G_OBJECT(record_sink_), "sync", true, NULL);
@@ -1522,7 +1849,7 @@ bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
     }
 #endif
 
-    if (format_ == kFormatYUV && memtype_ != kMemtypeShmem)
+    if (IsRawFormat() && memtype_ != kMemtypeShmem)
         gst_bin_add(GST_BIN(pipeline_), record_queue_);
 
     gst_bin_add_many(GST_BIN(pipeline_), record_convert_, record_encoder_,
@@ -1533,7 +1860,7 @@ bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
     gst_bin_add(GST_BIN(pipeline_), record_parse_);
 #endif
 
-    if (format_ == kFormatYUV && memtype_ != kMemtypeShmem)
+    if (IsRawFormat() && memtype_ != kMemtypeShmem)
     {
         if (TRUE != gst_element_link_many(record_queue_, record_convert_, NULL))
         {
@@ -1677,7 +2004,7 @@ bool CameraPlayer::CreateRecordElements(GstPad* tee_record_pad,
         CMP_DEBUG_PRINT("Sync state failed:%d\n",__LINE__);
         return false;
     }
-    if (format_ == kFormatYUV && memtype_ != kMemtypeShmem)
+    if (IsRawFormat() && memtype_ != kMemtypeShmem)
     {
         if (TRUE != gst_element_sync_state_with_parent(record_queue_))
         {
@@ -1829,9 +2156,9 @@ drop:
     return GST_BUS_DROP;
 }
 
-bool CameraPlayer::LoadYUY2Pipeline()
+bool CameraPlayer::LoadRawPipeline()
 {
-    CMP_DEBUG_PRINT("YUY2 FORMAT");
+    CMP_DEBUG_PRINT("%s FORMAT", format_.c_str());
 
     filter_YUY2_ = gst_element_factory_make("capsfilter", "filter-YUY2");
     if (!filter_YUY2_) {
@@ -1849,7 +2176,7 @@ bool CameraPlayer::LoadYUY2Pipeline()
             "framerate", GST_TYPE_FRACTION,
             framerate_, 1,
             "format", G_TYPE_STRING,
-            kFormatYUV.c_str(),
+            format_.c_str(),
             NULL);
     caps_I420_ = gst_caps_new_simple("video/x-raw",
             "width", G_TYPE_INT, width_,
@@ -1869,7 +2196,8 @@ bool CameraPlayer::LoadYUY2Pipeline()
         CMP_DEBUG_PRINT("parser_(%p) Failed", parser_);
         return false;
     }
-    g_object_set(G_OBJECT(parser_), "format", GST_VIDEO_FORMAT_YUY2 , NULL);
+    g_object_set(G_OBJECT(parser_), "format", gst_video_format_from_string(format_.c_str()),
+                 NULL);
     g_object_set(G_OBJECT(parser_), "width", width_ , NULL);
     g_object_set(G_OBJECT(parser_), "height", height_ , NULL);
 
@@ -1897,6 +2225,11 @@ bool CameraPlayer::LoadYUY2Pipeline()
     }
 }
 
+bool CameraPlayer::IsRawFormat() const
+{
+    return format_ == kFormatYUV || format_ == kFormatNV12 || format_ == kFormatI420;
+}
+
 bool CameraPlayer::LoadJPEGPipeline()
 {
     CMP_DEBUG_PRINT("JPEG FORMAT");
@@ -1913,11 +2246,12 @@ bool CameraPlayer::LoadJPEGPipeline()
         return false;
     }
 
-    decoder_ = gst_element_factory_make("jpegdec", "jpeg-decoder");
+    decoder_ = ElementRegistry::instance().make("video-codec-mjpeg", "jpegdec", "jpeg-decoder");
     if (!decoder_) {
         CMP_DEBUG_PRINT("tee_ element creation failed.");
         return false;
     }
+    ElementRegistry::instance().configure("video-codec-mjpeg", decoder_);
 
     filter_JPEG_ = gst_element_factory_make("capsfilter", "filter-JPEG");
     if (!filter_JPEG_) {
@@ -1933,22 +2267,30 @@ bool CameraPlayer::LoadJPEGPipeline()
 
     g_object_set(G_OBJECT(filter_JPEG_), "caps", caps_JPEG_, NULL);
 
+    jpeg_tee_ = gst_element_factory_make("tee", "jpeg-tee");
+    if (!jpeg_tee_) {
+        CMP_DEBUG_PRINT("jpeg_tee_ element creation failed.");
+        return false;
+    }
+
     if(width_ > WIDTH_1280 || height_ > HEIGHT_720)
     {
-        gst_bin_add_many(GST_BIN(pipeline_), source_, filter_JPEG_, parser_, decoder_, tee_,
-                NULL);
+        gst_bin_add_many(GST_BIN(pipeline_), source_, filter_JPEG_, parser_, jpeg_tee_, decoder_,
+                tee_, NULL);
 
-        if (TRUE != gst_element_link_many(source_, filter_JPEG_, decoder_, tee_, NULL)) {
+        if (TRUE != gst_element_link_many(source_, filter_JPEG_, jpeg_tee_, decoder_, tee_,
+                    NULL)) {
             CMP_DEBUG_PRINT("Elements could not be linked.\n");
             return false;
         }
     }
     else
     {
-        gst_bin_add_many(GST_BIN(pipeline_), source_, filter_JPEG_, parser_, decoder_, tee_,
-                NULL);
+        gst_bin_add_many(GST_BIN(pipeline_), source_, filter_JPEG_, parser_, jpeg_tee_, decoder_,
+                tee_, NULL);
 
-        if (TRUE != gst_element_link_many(source_, filter_JPEG_, parser_, decoder_, tee_, NULL)) {
+        if (TRUE != gst_element_link_many(source_, filter_JPEG_, parser_, jpeg_tee_, decoder_,
+                    tee_, NULL)) {
             CMP_DEBUG_PRINT("Elements could not be linked.\n");
             return false;
         }
@@ -2040,87 +2382,157 @@ base::error_t CameraPlayer::HandleErrorMessage(GstMessage *message)
     return error;
 }
 
-void CameraPlayer::FeedData (GstElement * appsrc, guint size, gpointer gdata)
+// Frames from the ring are handed downstream in pooled buffers that keep
+// their slot leased, so kShmemPoolMaxBuffers bounds the frames in flight.
+bool CameraPlayer::SetupShmemBufferPool(bool posix)
 {
-    CameraPlayer *player = reinterpret_cast<CameraPlayer *>(gdata);
-    unsigned char *data = 0;
-    int len = 0;
-    unsigned char *meta; int meta_len;
-    static GstClockTime timestamp = 0;
-    if (player->shm_listener_)
-    {
-        player->shm_listener_->wait();
-        ReadShmem(player->context_.shmemHandle, &data, &len, &meta, &meta_len);
-    }
-    else
-    {
-        while (len == 0)
-        {
-            ReadShmem(player->context_.shmemHandle, &data, &len, &meta, &meta_len);
-        }
-    }
-#ifdef PTZ_ENABLED
-    //Auto PTZ
-    if (player->postProcessSolution_)
+    GstBufferPool *pool = cmp_shmem_buffer_pool_new(context_.shmemHandle, posix);
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+
+    gst_buffer_pool_config_set_params(config, NULL, 0, kShmemPoolMinBuffers,
+                                      kShmemPoolMaxBuffers);
+    gst_buffer_pool_config_add_option(config, CMP_BUFFER_POOL_OPTION_SHMEM_LEASE);
+    if (!gst_buffer_pool_set_config(pool, config) || !gst_buffer_pool_set_active(pool, TRUE))
     {
-        CMP_DEBUG_PRINT("meta len = %d, meta = %u", meta_len, *meta);
-        player->postProcessSolution_->pushMetaData(meta, meta_len);
+        CMP_DEBUG_PRINT("shmem buffer pool setup failed");
+        gst_object_unref(pool);
+        return false;
     }
-    //end
-#endif
-    GstBuffer *buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, data, len, 0, len, NULL, NULL);
-    GST_BUFFER_PTS (buf) = timestamp;
-    GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (1, GST_SECOND, framerate);
-    timestamp += GST_BUFFER_DURATION (buf);
-    gst_app_src_push_buffer((GstAppSrc*)appsrc, buf);
-#ifdef PTZ_ENABLED
-    //Auto PTZ
-    if (player->postProcessSolution_)
+
+    context_.bufferPool = pool;
+    return true;
+}
+
+bool CameraPlayer::StartShmemNotifier(bool posix)
+{
+    shm_notifier_ = new ShmemNotifier();
+    if (!shm_notifier_->start(context_.shmemHandle, posix, shm_listener_))
     {
-        player->postProcessSolution_->doPostProcess();
+        CMP_DEBUG_PRINT("shmem notifier start failed");
+        delete shm_notifier_;
+        shm_notifier_ = nullptr;
+        return false;
     }
-    //end
-#endif
+    shm_source_id_ = g_unix_fd_add(shm_notifier_->fd(), G_IO_IN, OnShmemFrame, this);
+    return true;
 }
 
-void CameraPlayer::FeedPosixData (GstElement * appsrc, guint size, gpointer gdata)
+// need-data and enough-data run on the appsrc streaming thread. Frames are
+// pushed from the main context, by OnShmemFrame(), while appsrc wants data.
+void CameraPlayer::FeedData (GstElement * appsrc, guint size, gpointer gdata)
 {
     CameraPlayer *player = reinterpret_cast<CameraPlayer *>(gdata);
-    unsigned char *data = 0;
-    int len = 0;
-    unsigned char *meta; int meta_len;
-    static GstClockTime timestamp = 0;
-    if (player->shm_listener_)
-    {
-        player->shm_listener_->wait();
-        ReadPosixShmem(player->context_.shmemHandle, &data, &len, &meta, &meta_len);
-    }
-    else
+    g_atomic_int_set(&player->context_.needData, TRUE);
+    // frames may already be waiting in the ring
+    if (player->shm_notifier_)
+        player->shm_notifier_->notify();
+}
+
+void CameraPlayer::EnoughData (GstElement * appsrc, gpointer gdata)
+{
+    CameraPlayer *player = reinterpret_cast<CameraPlayer *>(gdata);
+    g_atomic_int_set(&player->context_.needData, FALSE);
+}
+
+gboolean CameraPlayer::OnShmemFrame (gint fd, GIOCondition condition, gpointer gdata)
+{
+    CameraPlayer *player = reinterpret_cast<CameraPlayer *>(gdata);
+    player->shm_notifier_->clear();
+    player->DrainShmem();
+    return G_SOURCE_CONTINUE;
+}
+
+// Pushes the unread frames in the ring until appsrc has enough. A buffer is
+// taken from the pool before each read, so when all of them are downstream
+// the frames stay in the ring for the next wakeup.
+void CameraPlayer::DrainShmem()
+{
+    GstAppSrcContext &context = context_;
+    bool posix = memtype_ == kMemtypePosixShm;
+    GstBufferPoolAcquireParams params = {};
+
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    while (g_atomic_int_get(&context.needData))
     {
-        while (len == 0)
+        SHMEM_FRAME_T frame = {};
+        GstBuffer *buf = NULL;
+        bool read;
+
+        if (gst_buffer_pool_acquire_buffer(context.bufferPool, &buf, &params) != GST_FLOW_OK)
+            break;
+
+        read = posix ? ReadPosixShmemFrame(context.shmemHandle, SHMEM_READ_NEXT, 0, &frame)
+                           == POSHMEM_COMM_OK
+                     : ReadShmemFrame(context.shmemHandle, SHMEM_READ_NEXT, 0, &frame)
+                           == SHMEM_COMM_OK;
+        if (!read)
         {
-            ReadPosixShmem(player->context_.shmemHandle, &data, &len, &meta, &meta_len);
+            gst_buffer_unref(buf);
+            break;
         }
+
+        if (frame.dropped > 0)
+        {
+            context.droppedFrames += frame.dropped;
+            CMP_DEBUG_PRINT("dropped %llu frame(s) before seq %llu, total %" G_GUINT64_FORMAT,
+                            frame.dropped, frame.seq, context.droppedFrames);
+        }
+        if (!cmp_shmem_buffer_pool_attach_frame(context.bufferPool, buf, &frame))
+            continue;
+
+        PushShmemFrame(buf, frame);
     }
+}
+
+// PushShmemFrame() stamps shm frames by sequence number rather than by
+// clock, so the capture start is the PTS the next published frame will get.
+GstClockTime CameraPlayer::ShmemCaptureStart() const
+{
+    SHMEM_STATS_T stats;
+    bool numbered = memtype_ == kMemtypePosixShm
+        ? GetPosixShmemStats(context_.shmemHandle, &stats) == POSHMEM_COMM_OK
+        : GetShmemStats(context_.shmemHandle, &stats) == SHMEM_COMM_OK;
+
+    if (!numbered)
+        return context_.timestamp;
+    if (context_.firstSeq == 0 || stats.last_seq + 1 < context_.firstSeq)
+        return GST_CLOCK_TIME_NONE;
+    return (stats.last_seq + 1 - context_.firstSeq) *
+           gst_util_uint64_scale_int(1, GST_SECOND, framerate);
+}
+
+void CameraPlayer::PushShmemFrame(GstBuffer *buf, const SHMEM_FRAME_T &frame)
+{
+    GstAppSrcContext &context = context_;
 #ifdef PTZ_ENABLED
     //Auto PTZ
-    if (player->postProcessSolution_)
+    if (postProcessSolution_)
     {
-        CMP_DEBUG_PRINT("meta len = %d, meta = %u", meta_len, *meta);
-        player->postProcessSolution_->pushMetaData(meta, meta_len);
+        CMP_DEBUG_PRINT("meta len = %d, meta = %u", frame.metaSize, *frame.pMeta);
+        postProcessSolution_->pushMetaData(frame.pMeta, frame.metaSize);
     }
     //end
 #endif
-    GstBuffer *buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, data, len, 0, len, NULL, NULL);
-    GST_BUFFER_PTS (buf) = timestamp;
     GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (1, GST_SECOND, framerate);
-    timestamp += GST_BUFFER_DURATION (buf);
-    gst_app_src_push_buffer((GstAppSrc*)appsrc, buf);
+    if (frame.seq != 0)
+    {
+        // pace by producer sequence so dropped frames leave a gap in the timeline
+        if (context.firstSeq == 0)
+            context.firstSeq = frame.seq;
+        GST_BUFFER_OFFSET (buf) = frame.seq;
+        GST_BUFFER_PTS (buf) = (frame.seq - context.firstSeq) * GST_BUFFER_DURATION (buf);
+    }
+    else
+    {
+        GST_BUFFER_PTS (buf) = context.timestamp;
+        context.timestamp += GST_BUFFER_DURATION (buf);
+    }
+    gst_app_src_push_buffer((GstAppSrc*)source_, buf);
 #ifdef PTZ_ENABLED
     //Auto PTZ
-    if (player->postProcessSolution_)
+    if (postProcessSolution_)
     {
-        player->postProcessSolution_->doPostProcess();
+        postProcessSolution_->doPostProcess();
     }
     //end
 #endif
@@ -2189,37 +2601,74 @@ void CameraPlayer::FreePreviewBinElements ()
 GstFlowReturn CameraPlayer::GetSample(GstAppSink *elt, gpointer data)
 {
     CameraPlayer *player = reinterpret_cast<CameraPlayer*>(data);
-    if (player->num_of_images_to_capture_ == player->num_of_captured_images_) {
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK (elt));
+    if (NULL == sample)
+        return GST_FLOW_OK;
+
+    // the branch stays linked for the whole burst, frames after the last
+    // image only drain until the remove probe runs
+    if (player->num_of_captured_images_ >= player->num_of_images_to_capture_) {
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (player->capture_armed_ && GST_CLOCK_TIME_IS_VALID(pts) &&
+        GST_CLOCK_TIME_IS_VALID(player->capture_start_) && pts < player->capture_start_) {
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+    if (player->capture_interval_ > 0 && GST_CLOCK_TIME_IS_VALID(pts) &&
+        GST_CLOCK_TIME_IS_VALID(player->last_capture_pts_) &&
+        pts < player->last_capture_pts_ + player->capture_interval_) {
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+
+    // storage is slow, the writer thread reports each image once it is on disk
+    if (gst_buffer_get_size(buffer) == 0 ||
+        !player->image_writer_->push(buffer, player->MakeImagePath(),
+                                     player->num_of_captured_images_ + 1,
+                                     player->num_of_images_to_capture_,
+                                     player->capture_to_shm_)) {
+        CMP_DEBUG_PRINT("image writer busy, frame skipped");
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+    gst_sample_unref(sample);
+    player->last_capture_pts_ = pts;
+    player->num_of_captured_images_++;
+
+    if (player->num_of_captured_images_ == player->num_of_images_to_capture_ &&
+        player->capture_armed_) {
+        g_atomic_int_set(&player->capture_gate_open_, FALSE);
+        player->capture_path_.clear();
         player->num_of_images_to_capture_ = 0;
         player->num_of_captured_images_ = 0;
+    } else if (player->num_of_captured_images_ == player->num_of_images_to_capture_) {
         gst_pad_add_probe(player->tee_capture_pad_, GST_PAD_PROBE_TYPE_IDLE ,
                 CaptureRemoveProbe, player, NULL);
-    } else {
-        GstSample *sample;
-        sample = gst_app_sink_pull_sample(GST_APP_SINK (elt));
-        if (NULL != sample) {
-            GstMapInfo map;
-            GstBuffer *buffer;
-            buffer = gst_sample_get_buffer(sample);
-            gst_buffer_map(buffer, &map, GST_MAP_READ);
-            if ((NULL != map.data) && (map.size != 0)) {
-                player->WriteImageToFile(map.data,map.size);
-            }
-            gst_sample_unref(sample);
-            gst_buffer_unmap(buffer, &map);
-            player->num_of_captured_images_++;
-        }
     }
     return GST_FLOW_OK;
 }
 
+GstPadProbeReturn
+CameraPlayer::CaptureGateProbe(
+        GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    CameraPlayer *player = reinterpret_cast<CameraPlayer *>(user_data);
+    return g_atomic_int_get(&player->capture_gate_open_) ? GST_PAD_PROBE_OK
+                                                         : GST_PAD_PROBE_DROP;
+}
+
 GstPadProbeReturn
 CameraPlayer::CaptureRemoveProbe(
         GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
 {
     CameraPlayer *player = reinterpret_cast<CameraPlayer *>(user_data);
     gst_pad_unlink(player->tee_capture_pad_, player->capture_queue_pad_);
-    gst_element_release_request_pad(player->tee_, player->tee_capture_pad_);
+    gst_element_release_request_pad(player->CaptureTee(), player->tee_capture_pad_);
 
     gst_object_unref(player->tee_capture_pad_);
     gst_object_unref(player->capture_queue_pad_);
@@ -2232,13 +2681,15 @@ CameraPlayer::CaptureRemoveProbe(
     gst_object_unref(player->capture_queue_);
     player->capture_queue_ = NULL;
 
-    if (TRUE != gst_bin_remove(GST_BIN(player->pipeline_),
-                player->capture_encoder_)) {
-        CMP_DEBUG_PRINT("Failed %d\n\n",__LINE__);
+    if (player->capture_encoder_) {
+        if (TRUE != gst_bin_remove(GST_BIN(player->pipeline_),
+                    player->capture_encoder_)) {
+            CMP_DEBUG_PRINT("Failed %d\n\n",__LINE__);
+        }
+        gst_element_set_state(player->capture_encoder_, GST_STATE_NULL);
+        gst_object_unref(player->capture_encoder_);
+        player->capture_encoder_ = NULL;
     }
-    gst_element_set_state(player->capture_encoder_, GST_STATE_NULL);
-    gst_object_unref(player->capture_encoder_);
-    player->capture_encoder_ = NULL;
 
     if (TRUE != gst_bin_remove(GST_BIN(player->pipeline_),
                 player->capture_sink_)) {
@@ -2249,6 +2700,8 @@ CameraPlayer::CaptureRemoveProbe(
     player->capture_sink_ = NULL;
 
     player->capture_path_.clear();
+    player->num_of_images_to_capture_ = 0;
+    player->num_of_captured_images_ = 0;
     return GST_PAD_PROBE_REMOVE;
 }
 
@@ -2292,7 +2745,7 @@ void CameraPlayer::finalizeRecord(gpointer user_data)
     gst_object_unref(player->record_video_queue_pad_);
     gst_object_unref(player->record_video_mux_pad_);
 
-    if (player->format_ == kFormatYUV && player->memtype_ != kMemtypeShmem)
+    if (player->IsRawFormat() && player->memtype_ != kMemtypeShmem)
         gst_element_unlink_many(player->record_queue_, player->record_convert_, NULL);
 #ifndef PLATFORM_QEMUX86
     gst_element_unlink(player->record_convert_, player->filter_NV12_);
@@ -2357,7 +2810,7 @@ void CameraPlayer::finalizeRecord(gpointer user_data)
         player->record_audio_encoder_pad_ = NULL;
     }
 
-    if (player->format_ == kFormatYUV && player->memtype_ != kMemtypeShmem)
+    if (player->IsRawFormat() && player->memtype_ != kMemtypeShmem)
     {
         if (player->record_queue_ != NULL)
         {
@@ -2463,6 +2916,7 @@ void CameraPlayer::finalizeRecord(gpointer user_data)
     player->record_sink_ = NULL;
 
     player->record_path_.clear();
+    player->SetShmemReaderLossless(false);
     recordingStarted = false;
     return;
 }
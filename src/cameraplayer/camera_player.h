@@ -35,8 +35,10 @@
 #include "cam_posixshm.h"
 #include "camera_types.h"
 #include <mutex>
+#include <deque>
 #include "camera_service_client.h"
-#include "signal_listener.h"
+#include "shmem_notifier.h"
+#include "image_writer.h"
 
 using namespace std;
 
@@ -53,6 +55,11 @@ typedef struct _GstAppSrcContext
     gint isStreaming;
     gint isFirstCallback;
     GstAppSrc *appsrc;
+    guint64 firstSeq;
+    guint64 droppedFrames;
+    GstBufferPool *bufferPool;
+    gint needData;
+    GstClockTime timestamp;
 }GstAppSrcContext;
 
 typedef struct ACQUIRE_RESOURCE_INFO {
@@ -104,7 +111,8 @@ class CameraPlayer {
   void RegisterCbFunction(CALLBACK_T);
   bool Play();
   bool subscribeToCameraService();
-  bool TakeSnapshot(const std::string& location);
+  bool TakeSnapshot(const std::string& location, int count = 1, int interval = 0,
+                    bool shm = false);
   bool StartRecord(const std::string& location, const std::string& format,
                      bool audio, const std::string& audioSrc);
   bool StopRecord();
@@ -128,7 +136,8 @@ class CameraPlayer {
   void SetGstreamerDebug();
   bool attachSurface(bool allow_no_window = false);
   bool detachSurface();
-  void WriteImageToFile(const void *p, int size);
+  std::string MakeImagePath();
+  bool StartImageWriter();
   bool GetSourceInfo();
   bool LoadPipeline();
   bool SetPlayerState(base::playback_state_t state) {
@@ -136,11 +145,16 @@ class CameraPlayer {
     return true;
   }
 
+  GstElement *CreateVideoConverter(const char *name) const;
   bool CreatePreviewBin(GstPad * pad);
+  GstCaps *CreatePreviewCaps() const;
   bool CreateCaptureElements(GstPad * pad);
+  bool ArmCaptureBranch();
+  GstElement *CaptureTee() const;
   bool CreateRecordElements(GstPad * pad, GstPad *, const std::string& fileFormat);
   bool CreateAudioRecordElements(const std::string&, GstPad * pad);
-  bool LoadYUY2Pipeline();
+  bool LoadRawPipeline();
+  bool IsRawFormat() const;
   bool LoadJPEGPipeline();
   int32_t ConvertErrorCode(GQuark domain, gint code);
   base::error_t HandleErrorMessage(GstMessage *message);
@@ -149,11 +163,24 @@ class CameraPlayer {
   void FreeCaptureElements();
   void FreeRecordElements();
   void FreePreviewBinElements();
+  void SetShmemReaderLossless(bool lossless);
+  bool SetupShmemBufferPool(bool posix);
+  bool StartShmemNotifier(bool posix);
+  void StopSignalListener();
+  void DrainShmem();
+  void PushShmemFrame(GstBuffer *buf, const SHMEM_FRAME_T &frame);
+  GstClockTime ShmemCaptureStart() const;
 
   static void FeedData(GstElement * appsrc, guint size, gpointer gdata);
-  static void FeedPosixData(GstElement * appsrc, guint size, gpointer gdata);
+  static void EnoughData(GstElement * appsrc, gpointer gdata);
+  static gboolean OnShmemFrame(gint fd, GIOCondition condition, gpointer gdata);
+  void QueueCaptureNotice(const base::capture_info_t &info);
+  static gboolean NotifyCaptures(gpointer gdata);
   static void finalizeRecord(gpointer gdata);
   static GstFlowReturn GetSample(GstAppSink *elt, gpointer data);
+  static GstPadProbeReturn CaptureGateProbe(GstPad * pad,
+                                              GstPadProbeInfo * info,
+                                              gpointer user_data);
   static GstPadProbeReturn CaptureRemoveProbe(GstPad * pad,
                                                 GstPadProbeInfo * info,
                                                 gpointer user_data);
@@ -167,6 +194,9 @@ class CameraPlayer {
   int32_t planeId_, width_, height_, framerate_, crtcId_, connId_,
             display_path_idx_,handle_, iomode_;
   int  num_of_images_to_capture_, num_of_captured_images_;
+  GstClockTime capture_interval_, last_capture_pts_, capture_start_;
+  bool capture_armed_, capture_to_shm_;
+  gint capture_gate_open_;
   std::string uri_, memtype_, memsrc_, format_, capture_path_, record_path_;
   GstElement *pipeline_, *source_, *parser_, *decoder_, *filter_YUY2_, *filter_NV12_, *filter_H264_,
              *filter_I420_, *filter_JPEG_, *filter_RGB_, *vconv_, *record_convert_,
@@ -175,7 +205,7 @@ class CameraPlayer {
              *record_encoder_, *record_parse_, *record_decoder_, *record_mux_, *record_sink_,
              *preview_queue_, *preview_sink_, *record_audio_src_, *record_audio_queue_,
              *record_audio_convert_, *record_video_queue_, *record_audio_encoder_, *preview_scale_,
-             *preview_video_crop_;
+             *preview_video_crop_, *jpeg_tee_;
   GstPad *tee_preview_pad_, *preview_ghost_sinkpad_, *preview_queue_pad_,
          *capture_queue_pad_, *tee_capture_pad_, *record_queue_pad_,
          *tee_record_pad_, *record_audio_encoder_pad_, *record_video_queue_pad_,
@@ -198,6 +228,18 @@ class CameraPlayer {
   std::string camera_id_;
   CameraServiceClient *cs_client_;
   SignalListener *shm_listener_;
+  ShmemNotifier *shm_notifier_;
+  guint shm_source_id_;
+
+  /* snapshot storage */
+  ImageWriter *image_writer_;
+  std::string snapshot_sync_;
+  bool snapshot_direct_io_;
+  mode_t snapshot_shm_mode_;
+  int snapshot_shm_lifetime_;
+  std::mutex capture_notice_lock_;
+  std::deque<base::capture_info_t> capture_notices_;
+  guint capture_notice_id_;
 };
 #ifdef PTZ_ENABLED
 IPostProcessSolution *getPostProcessSolution();
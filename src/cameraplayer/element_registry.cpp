@@ -0,0 +1,121 @@
+#include "element_registry.h"
+#include <fstream>
+#include <sstream>
+#include <pbnjson.hpp>
+#include <log/log.h>
+
+#ifdef CMP_DEBUG_PRINT
+#undef CMP_DEBUG_PRINT
+#endif
+#define CMP_DEBUG_PRINT CMP_INFO_PRINT
+
+static const char *kElementsConfPath = "/etc/g-camera-pipeline/gst_elements.conf";
+
+const ElementRegistry &ElementRegistry::instance()
+{
+    static const ElementRegistry registry;
+    return registry;
+}
+
+ElementRegistry::ElementRegistry()
+{
+    if (!load(kElementsConfPath))
+        CMP_DEBUG_PRINT("using built-in elements");
+}
+
+bool ElementRegistry::load(const char *path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        CMP_DEBUG_PRINT("%s not found", path);
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+
+    pbnjson::JDomParser parser;
+    if (!parser.parse(text.str(), pbnjson::JSchema::AllSchema()))
+    {
+        CMP_DEBUG_PRINT("%s could not be parsed", path);
+        return false;
+    }
+
+    // the first set is the camera pipeline's; the second one is for media playback
+    pbnjson::JValue elements = parser.getDom()["gst_elements"];
+    if (!elements.isArray() || elements.arraySize() == 0 || !elements[0].isObject())
+    {
+        CMP_DEBUG_PRINT("%s has no gst_elements", path);
+        return false;
+    }
+
+    for (const auto &role : elements[0].children())
+    {
+        if (!role.second.isObject() || !role.second.hasKey("name"))
+            continue;
+
+        Entry entry;
+        entry.factory = role.second["name"].asString();
+        if (role.second.hasKey("max-width") && role.second["max-width"].isNumber())
+            entry.max_width = role.second["max-width"].asNumber<int>();
+        if (role.second.hasKey("max-height") && role.second["max-height"].isNumber())
+            entry.max_height = role.second["max-height"].asNumber<int>();
+        if (role.second.hasKey("properties"))
+        {
+            for (const auto &prop : role.second["properties"].children())
+            {
+                entry.properties[prop.first.asString()] =
+                    prop.second.isString() ? prop.second.asString() : prop.second.stringify();
+            }
+        }
+        CMP_DEBUG_PRINT("%s : %s", role.first.asString().c_str(), entry.factory.c_str());
+        entries_[role.first.asString()] = entry;
+    }
+    return true;
+}
+
+GstElement *ElementRegistry::make(const std::string &role, const std::string &fallback,
+                                  const char *name, int width, int height) const
+{
+    auto it = entries_.find(role);
+    if (it != entries_.end() && !it->second.factory.empty())
+    {
+        const Entry &entry = it->second;
+        if ((entry.max_width > 0 && width > entry.max_width) ||
+            (entry.max_height > 0 && height > entry.max_height))
+        {
+            CMP_DEBUG_PRINT("%dx%d is too large for %s, using %s", width, height,
+                            entry.factory.c_str(), fallback.c_str());
+            return gst_element_factory_make(fallback.c_str(), name);
+        }
+
+        GstElement *element = gst_element_factory_make(it->second.factory.c_str(), name);
+        if (element)
+            return element;
+        CMP_DEBUG_PRINT("%s is not available for %s, using %s", it->second.factory.c_str(),
+                        role.c_str(), fallback.c_str());
+    }
+    return gst_element_factory_make(fallback.c_str(), name);
+}
+
+void ElementRegistry::configure(const std::string &role, GstElement *element) const
+{
+    auto it = entries_.find(role);
+    if (!element || it == entries_.end())
+        return;
+
+    GstElementFactory *factory = gst_element_get_factory(element);
+    if (!factory || it->second.factory != GST_OBJECT_NAME(factory))
+        return;
+
+    for (const auto &prop : it->second.properties)
+    {
+        if (!g_object_class_find_property(G_OBJECT_GET_CLASS(element), prop.first.c_str()))
+        {
+            CMP_DEBUG_PRINT("%s has no property %s", it->second.factory.c_str(),
+                            prop.first.c_str());
+            continue;
+        }
+        gst_util_set_object_arg(G_OBJECT(element), prop.first.c_str(), prop.second.c_str());
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef ELEMENT_REGISTRY_H_
+#define ELEMENT_REGISTRY_H_
+
+#include <gst/gst.h>
+#include <map>
+#include <string>
+
+// Platform element choices from gst_elements.conf, keyed by role such as
+// "video-converter" or "video-sink". Read once, on first use.
+class ElementRegistry
+{
+public:
+    static const ElementRegistry &instance();
+
+    // Creates the element configured for role, or fallback if the role is
+    // missing, empty or its factory is not installed. A width or height
+    // above the role's "max-width" or "max-height" also picks fallback.
+    GstElement *make(const std::string &role, const std::string &fallback,
+                     const char *name, int width = 0, int height = 0) const;
+    // Applies the role's configured properties. Call it after the player's
+    // own defaults so the platform file wins.
+    void configure(const std::string &role, GstElement *element) const;
+
+private:
+    struct Entry
+    {
+        std::string factory;
+        std::map<std::string, std::string> properties;
+        int max_width = 0;  // 0 if unlimited
+        int max_height = 0;
+    };
+
+    ElementRegistry();
+    bool load(const char *path);
+
+    std::map<std::string, Entry> entries_;
+};
+
+#endif /* ELEMENT_REGISTRY_H_ */
@@ -0,0 +1,268 @@
+#include "image_writer.h"
+#include <log/log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef CMP_DEBUG_PRINT
+#undef CMP_DEBUG_PRINT
+#endif
+#define CMP_DEBUG_PRINT CMP_INFO_PRINT
+
+// O_DIRECT wants offsets, sizes and memory aligned to the logical block
+#define IMAGE_WRITER_ALIGN 4096
+
+static bool WriteAll(int fd, const guint8 *data, gsize size)
+{
+    gsize done = 0;
+    while (done < size)
+    {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+ImageWriter::ImageWriter(size_t max_pending, SyncPolicy sync, bool direct_io,
+                         Callback callback) :
+    max_pending_(max_pending),
+    sync_(sync),
+    direct_io_(direct_io),
+    callback_(callback),
+    running_(false),
+    shm_mode_(0600),
+    shm_lifetime_(30),
+    burst_fd_(-1)
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+    stop();
+}
+
+bool ImageWriter::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_)
+        return true;
+    running_ = true;
+    thread_ = std::thread{[this]() { this->run(); }};
+    return true;
+}
+
+// Images already queued are still written before the thread exits.
+void ImageWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_one();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void ImageWriter::setShmPolicy(mode_t mode, std::chrono::seconds lifetime)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    shm_mode_     = mode;
+    shm_lifetime_ = lifetime;
+}
+
+bool ImageWriter::push(GstBuffer *buffer, const std::string &path, int index, int count,
+                       bool shm)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_ || pending_.size() >= max_pending_)
+            return false;
+        pending_.push_back(Image{gst_buffer_ref(buffer), path, index, count, shm});
+    }
+    cond_.notify_one();
+    return true;
+}
+
+ImageWriter::SyncPolicy ImageWriter::toSyncPolicy(const std::string &name)
+{
+    if (name == "image")
+        return SyncPolicy::IMAGE;
+    if (name == "burst")
+        return SyncPolicy::BURST;
+    return SyncPolicy::NONE;
+}
+
+void ImageWriter::run()
+{
+    while (true)
+    {
+        Image image;
+        bool have_image = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto ready = [this]() { return !running_ || !pending_.empty(); };
+            // only wake up for expiry while there is something to expire
+            if (shm_names_.empty())
+                cond_.wait(lock, ready);
+            else
+                cond_.wait_until(lock, shm_names_.front().second + shm_lifetime_, ready);
+            if (!pending_.empty())
+            {
+                image = pending_.front();
+                pending_.pop_front();
+                have_image = true;
+            }
+            else if (!running_)
+                break;
+        }
+
+        if (have_image)
+        {
+            bool written = write(image);
+            if (sync_ == SyncPolicy::BURST && image.index == image.count && !syncBurst())
+                written = false;
+            if (callback_)
+                callback_(image, written);
+            gst_buffer_unref(image.buffer);
+        }
+        reapShm(false);
+    }
+    syncBurst();
+    reapShm(true);
+}
+
+// One syncfs flushes every image of the burst. The images before a failed
+// last one are still flushed, and a burst cut short is flushed on stop.
+bool ImageWriter::syncBurst()
+{
+    if (burst_fd_ == -1)
+        return true;
+
+    bool ok = syncfs(burst_fd_) == 0;
+    if (!ok)
+        CMP_DEBUG_PRINT("syncfs failed: %s", strerror(errno));
+    close(burst_fd_);
+    burst_fd_ = -1;
+    return ok;
+}
+
+// Readers that finished with an image may unlink it themselves; names they
+// never claimed are removed here so they cannot pile up in /dev/shm.
+void ImageWriter::reapShm(bool all)
+{
+    auto now = std::chrono::steady_clock::now();
+    while (!shm_names_.empty() && (all || now - shm_names_.front().second >= shm_lifetime_))
+    {
+        if (shm_unlink(shm_names_.front().first.c_str()) == 0)
+            CMP_DEBUG_PRINT("unclaimed snapshot %s removed", shm_names_.front().first.c_str());
+        shm_names_.pop_front();
+    }
+}
+
+bool ImageWriter::write(const Image &image)
+{
+    GstMapInfo map;
+    if (!gst_buffer_map(image.buffer, &map, GST_MAP_READ))
+    {
+        CMP_DEBUG_PRINT("image %d map failed", image.index);
+        return false;
+    }
+
+    if (image.shm)
+    {
+        bool ok = writeShm(image, map.data, map.size);
+        gst_buffer_unmap(image.buffer, &map);
+        return ok;
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = direct_io_ ? open(image.path.c_str(), flags | O_DIRECT, 0644) : -1;
+    bool direct = fd != -1;
+    if (!direct)
+        fd = open(image.path.c_str(), flags, 0644);
+    if (fd == -1)
+    {
+        CMP_DEBUG_PRINT("File %s Open Failed", image.path.c_str());
+        gst_buffer_unmap(image.buffer, &map);
+        return false;
+    }
+
+    // reserving the extent up front keeps the file contiguous; not every
+    // filesystem supports it, which is fine
+    if (map.size > 0)
+        fallocate(fd, 0, 0, map.size);
+
+    bool ok = direct ? writeDirect(fd, map.data, map.size) : WriteAll(fd, map.data, map.size);
+    gst_buffer_unmap(image.buffer, &map);
+
+    if (ok && sync_ == SyncPolicy::IMAGE)
+        ok = fsync(fd) == 0;
+    // keeps a handle on the burst's filesystem for the syncfs at its end
+    if (ok && sync_ == SyncPolicy::BURST)
+    {
+        if (burst_fd_ != -1)
+            close(burst_fd_);
+        burst_fd_ = dup(fd);
+    }
+    if (close(fd) != 0)
+        ok = false;
+    if (!ok)
+        CMP_DEBUG_PRINT("File %s write failed: %s", image.path.c_str(), strerror(errno));
+    return ok;
+}
+
+bool ImageWriter::writeDirect(int fd, const guint8 *data, gsize size)
+{
+    gsize aligned = (size + IMAGE_WRITER_ALIGN - 1) & ~((gsize)IMAGE_WRITER_ALIGN - 1);
+    void *block = nullptr;
+    if (posix_memalign(&block, IMAGE_WRITER_ALIGN, aligned) != 0)
+        return false;
+
+    memcpy(block, data, size);
+    memset(static_cast<guint8 *>(block) + size, 0, aligned - size);
+
+    bool ok = WriteAll(fd, static_cast<guint8 *>(block), aligned);
+    free(block);
+
+    // drop the padding the last block needed
+    return ok && ftruncate(fd, size) == 0;
+}
+
+// Readers learn the name from the completion notification, so they only
+// see finished images.
+bool ImageWriter::writeShm(const Image &image, const guint8 *data, gsize size)
+{
+    int fd = shm_open(image.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        CMP_DEBUG_PRINT("shm_open %s failed: %s", image.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    mode_t mode;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        mode = shm_mode_;
+    }
+    // fchmod, unlike the shm_open mode, is not narrowed by the umask
+    bool ok = fchmod(fd, mode) == 0 && ftruncate(fd, size) == 0 && WriteAll(fd, data, size);
+    close(fd);
+    if (!ok)
+    {
+        CMP_DEBUG_PRINT("shm %s write failed: %s", image.path.c_str(), strerror(errno));
+        shm_unlink(image.path.c_str());
+        return false;
+    }
+    shm_names_.emplace_back(image.path, std::chrono::steady_clock::now());
+    return true;
+}
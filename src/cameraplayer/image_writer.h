@@ -0,0 +1,73 @@
+#ifndef IMAGE_WRITER_H_
+#define IMAGE_WRITER_H_
+
+#include <gst/gst.h>
+#include <sys/types.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes encoded snapshots to storage, or to named POSIX shared memory, on
+// its own thread, so slow flash never stalls the streaming thread that
+// produced them.
+class ImageWriter
+{
+public:
+    enum class SyncPolicy
+    {
+        NONE,  // leave flushing to the kernel
+        IMAGE, // fsync every image
+        BURST, // syncfs once the last image of a burst is written
+    };
+
+    struct Image
+    {
+        GstBuffer *buffer;
+        std::string path;
+        int index;
+        int count;
+        bool shm;   // path is a shm_open name
+    };
+
+    using Callback = std::function<void(const Image &image, bool written)>;
+
+    ImageWriter(size_t max_pending, SyncPolicy sync, bool direct_io, Callback callback);
+    ~ImageWriter();
+    bool start();
+    void stop();
+    // Shared memory images are created with mode and unlinked once they are
+    // lifetime old, or when the writer stops, unless the reader did it first.
+    void setShmPolicy(mode_t mode, std::chrono::seconds lifetime);
+    // Takes a reference on buffer. Returns false when the queue is full.
+    bool push(GstBuffer *buffer, const std::string &path, int index, int count, bool shm);
+
+    static SyncPolicy toSyncPolicy(const std::string &name);
+
+private:
+    size_t max_pending_;
+    SyncPolicy sync_;
+    bool direct_io_;
+    Callback callback_;
+    bool running_;
+    mode_t shm_mode_;
+    std::chrono::seconds shm_lifetime_;
+    // names handed out, oldest first; only the writer thread touches it
+    std::deque<std::pair<std::string, std::chrono::steady_clock::time_point>> shm_names_;
+    int burst_fd_;
+    std::deque<Image> pending_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+    void run();
+    bool write(const Image &image);
+    bool writeDirect(int fd, const guint8 *data, gsize size);
+    bool writeShm(const Image &image, const guint8 *data, gsize size);
+    void reapShm(bool all);
+    bool syncBurst();
+};
+
+#endif /* IMAGE_WRITER_H_ */
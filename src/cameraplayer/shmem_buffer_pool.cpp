@@ -0,0 +1,179 @@
+// Copyright (c) 2023 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "shmem_buffer_pool.h"
+#include "cam_posixshm.h"
+#include <log/log.h>
+
+#ifdef CMP_DEBUG_PRINT
+#undef CMP_DEBUG_PRINT
+#endif
+#define CMP_DEBUG_PRINT CMP_INFO_PRINT
+
+G_DEFINE_TYPE(CmpShmemBufferPool, cmp_shmem_buffer_pool, GST_TYPE_BUFFER_POOL);
+
+struct ShmemLease
+{
+    SHMEM_HANDLE handle;
+    int slot;
+    bool posix;
+};
+
+static void ReleaseShmemLease(gpointer data)
+{
+    ShmemLease *lease = static_cast<ShmemLease *>(data);
+    if (lease->posix)
+        UnpinPosixShmemFrame(lease->handle, lease->slot);
+    else
+        UnpinShmemFrame(lease->handle, lease->slot);
+    delete lease;
+}
+
+static bool PinFrame(CmpShmemBufferPool *self, const SHMEM_FRAME_T *frame)
+{
+    return self->posix ? PinPosixShmemFrame(self->handle, frame) == POSHMEM_COMM_OK
+                       : PinShmemFrame(self->handle, frame) == SHMEM_COMM_OK;
+}
+
+static bool FrameIntact(CmpShmemBufferPool *self, const SHMEM_FRAME_T *frame)
+{
+    return self->posix ? ValidatePosixShmemFrame(self->handle, frame) == POSHMEM_COMM_OK
+                       : ValidateShmemFrame(self->handle, frame) == SHMEM_COMM_OK;
+}
+
+static const gchar **cmp_shmem_buffer_pool_get_options(GstBufferPool *pool)
+{
+    static const gchar *options[] = {CMP_BUFFER_POOL_OPTION_SHMEM_LEASE, NULL};
+    return options;
+}
+
+static gboolean cmp_shmem_buffer_pool_set_config(GstBufferPool *pool, GstStructure *config)
+{
+    CmpShmemBufferPool *self = CMP_SHMEM_BUFFER_POOL(pool);
+    GstCaps *caps = NULL;
+    guint size, min, max;
+
+    if (!gst_buffer_pool_config_get_params(config, &caps, &size, &min, &max))
+        return FALSE;
+
+    self->lease = gst_buffer_pool_config_has_option(config, CMP_BUFFER_POOL_OPTION_SHMEM_LEASE);
+    if (self->lease)
+    {
+        // buffers go back to the pool empty, and the base class only takes
+        // back buffers of the configured size
+        gst_buffer_pool_config_set_params(config, caps, 0, min, max);
+    }
+    else if (size == 0)
+    {
+        CMP_DEBUG_PRINT("copying pool needs a buffer size");
+        return FALSE;
+    }
+
+    return GST_BUFFER_POOL_CLASS(cmp_shmem_buffer_pool_parent_class)->set_config(pool, config);
+}
+
+static GstFlowReturn cmp_shmem_buffer_pool_alloc_buffer(GstBufferPool *pool, GstBuffer **buffer,
+                                                       GstBufferPoolAcquireParams *params)
+{
+    CmpShmemBufferPool *self = CMP_SHMEM_BUFFER_POOL(pool);
+
+    if (self->lease)
+    {
+        *buffer = gst_buffer_new();
+        return GST_FLOW_OK;
+    }
+    return GST_BUFFER_POOL_CLASS(cmp_shmem_buffer_pool_parent_class)->alloc_buffer(pool, buffer,
+                                                                                   params);
+}
+
+static void cmp_shmem_buffer_pool_reset_buffer(GstBufferPool *pool, GstBuffer *buffer)
+{
+    CmpShmemBufferPool *self = CMP_SHMEM_BUFFER_POOL(pool);
+
+    if (self->lease)
+    {
+        // dropping the slot memory ends its lease
+        gst_buffer_remove_all_memory(buffer);
+        GST_BUFFER_FLAG_UNSET(buffer, GST_BUFFER_FLAG_TAG_MEMORY);
+    }
+    GST_BUFFER_OFFSET(buffer) = GST_BUFFER_OFFSET_NONE;
+    GST_BUFFER_POOL_CLASS(cmp_shmem_buffer_pool_parent_class)->reset_buffer(pool, buffer);
+}
+
+static void cmp_shmem_buffer_pool_class_init(CmpShmemBufferPoolClass *klass)
+{
+    GstBufferPoolClass *pool_class = GST_BUFFER_POOL_CLASS(klass);
+
+    pool_class->get_options  = cmp_shmem_buffer_pool_get_options;
+    pool_class->set_config   = cmp_shmem_buffer_pool_set_config;
+    pool_class->alloc_buffer = cmp_shmem_buffer_pool_alloc_buffer;
+    pool_class->reset_buffer = cmp_shmem_buffer_pool_reset_buffer;
+}
+
+static void cmp_shmem_buffer_pool_init(CmpShmemBufferPool *self)
+{
+    self->handle = NULL;
+    self->posix  = FALSE;
+    self->lease  = FALSE;
+}
+
+GstBufferPool *cmp_shmem_buffer_pool_new(SHMEM_HANDLE handle, gboolean posix)
+{
+    CmpShmemBufferPool *self =
+        CMP_SHMEM_BUFFER_POOL(g_object_new(CMP_TYPE_SHMEM_BUFFER_POOL, NULL));
+
+    self->handle = handle;
+    self->posix  = posix;
+    return GST_BUFFER_POOL(gst_object_ref_sink(self));
+}
+
+gboolean cmp_shmem_buffer_pool_attach_frame(GstBufferPool *pool, GstBuffer *buffer,
+                                            const SHMEM_FRAME_T *frame)
+{
+    CmpShmemBufferPool *self = CMP_SHMEM_BUFFER_POOL(pool);
+
+    if (self->lease)
+    {
+        if (PinFrame(self, frame))
+        {
+            ShmemLease *lease = new ShmemLease{self->handle, frame->slot, self->posix != FALSE};
+            gst_buffer_append_memory(buffer, gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+                                     frame->pData, frame->size, 0, frame->size, lease,
+                                     ReleaseShmemLease));
+            return TRUE;
+        }
+
+        // out of leases, or a producer without sequence numbers that cannot
+        // lease at all; this buffer gets its own memory for the copy
+        gst_buffer_append_memory(buffer, gst_allocator_alloc(NULL, frame->size, NULL));
+    }
+    else if ((gsize)frame->size > gst_buffer_get_size(buffer))
+    {
+        CMP_DEBUG_PRINT("frame of %d bytes does not fit the pool", frame->size);
+        gst_buffer_unref(buffer);
+        return FALSE;
+    }
+
+    gst_buffer_fill(buffer, 0, frame->pData, frame->size);
+    gst_buffer_set_size(buffer, frame->size);
+    if (!FrameIntact(self, frame))
+    {
+        CMP_DEBUG_PRINT("frame %llu was overwritten while copying", frame->seq);
+        gst_buffer_unref(buffer);
+        return FALSE;
+    }
+    return TRUE;
+}
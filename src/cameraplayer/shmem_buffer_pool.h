@@ -0,0 +1,66 @@
+// Copyright (c) 2023 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef SHMEM_BUFFER_POOL_H_
+#define SHMEM_BUFFER_POOL_H_
+
+#include <gst/gst.h>
+#include "camshm.h"
+
+G_BEGIN_DECLS
+
+#define CMP_TYPE_SHMEM_BUFFER_POOL (cmp_shmem_buffer_pool_get_type())
+#define CMP_SHMEM_BUFFER_POOL(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST((obj), CMP_TYPE_SHMEM_BUFFER_POOL, CmpShmemBufferPool))
+
+// With this option the pool hands out empty buffers and attaches the ring
+// slot itself, leased until the buffer returns to the pool. Without it,
+// buffers own memory of the configured size and frames are copied in.
+#define CMP_BUFFER_POOL_OPTION_SHMEM_LEASE "CmpBufferPoolOptionShmemLease"
+
+typedef struct _CmpShmemBufferPool CmpShmemBufferPool;
+typedef struct _CmpShmemBufferPoolClass CmpShmemBufferPoolClass;
+
+struct _CmpShmemBufferPool
+{
+    GstBufferPool parent;
+
+    SHMEM_HANDLE handle;
+    gboolean posix;
+    gboolean lease;
+};
+
+struct _CmpShmemBufferPoolClass
+{
+    GstBufferPoolClass parent_class;
+};
+
+GType cmp_shmem_buffer_pool_get_type(void);
+
+// Pool for frames of the SysV (posix == FALSE) or POSIX ring behind handle.
+// The max-buffers of its config caps the frames in flight in the pipeline.
+GstBufferPool *cmp_shmem_buffer_pool_new(SHMEM_HANDLE handle, gboolean posix);
+
+// Attaches frame to a buffer acquired from pool. Acquire the buffer before
+// reading the frame so a full pool leaves the frame unread in the ring.
+// Returns FALSE, and unrefs buffer, if the frame was overwritten while
+// being copied.
+gboolean cmp_shmem_buffer_pool_attach_frame(GstBufferPool *pool, GstBuffer *buffer,
+                                            const SHMEM_FRAME_T *frame);
+
+G_END_DECLS
+
+#endif /* SHMEM_BUFFER_POOL_H_ */
@@ -0,0 +1,117 @@
+#include "shmem_notifier.h"
+#include "cam_posixshm.h"
+#include <sys/eventfd.h>
+#include <log/log.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// how often stop() repeats its wakeup until the watch thread has left
+#define SHMEM_NOTIFIER_STOP_RETRY_US 1000
+
+ShmemNotifier::ShmemNotifier() :
+    fd_(-1),
+    handle_(nullptr),
+    posix_(false),
+    listener_(nullptr),
+    on_watch_(false),
+    watching_(false)
+{
+}
+
+ShmemNotifier::~ShmemNotifier()
+{
+    stop();
+}
+
+bool ShmemNotifier::start(SHMEM_HANDLE handle, bool posix, SignalListener *listener)
+{
+    fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd_ == -1)
+    {
+        CMP_DEBUG_PRINT("eventfd failed");
+        return false;
+    }
+
+    handle_   = handle;
+    posix_    = posix;
+
+    bool writer_wakes = posix
+        ? GetPosixShmemWriterWakes(handle) == POSHMEM_COMM_OK
+        : GetShmemWriterWakes(handle) == SHMEM_COMM_OK;
+    if (!writer_wakes && listener)
+    {
+        // waiting on the ring would only poll it, the service signals instead
+        listener_ = listener;
+        listener_->setHandler([this]() { this->notify(); });
+        return true;
+    }
+
+    on_watch_ = true;
+    watching_ = true;
+    watch_thread_ = std::thread{[this]() { this->watch(); }};
+    return true;
+}
+
+void ShmemNotifier::stop()
+{
+    if (listener_)
+    {
+        listener_->setHandler(nullptr);
+        listener_ = nullptr;
+    }
+    on_watch_ = false;
+    if (watch_thread_.joinable())
+    {
+        // the wait has no timeout, so interrupt it until the thread is out
+        while (watching_)
+        {
+            if (posix_)
+                WakePosixShmem(handle_);
+            else
+                WakeShmem(handle_);
+            usleep(SHMEM_NOTIFIER_STOP_RETRY_US);
+        }
+        watch_thread_.join();
+    }
+    if (fd_ != -1)
+    {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void ShmemNotifier::notify()
+{
+    uint64_t one = 1;
+    if (write(fd_, &one, sizeof(one)) != sizeof(one))
+    {
+        CMP_DEBUG_PRINT("eventfd write failed");
+    }
+}
+
+void ShmemNotifier::clear()
+{
+    uint64_t count;
+    while (read(fd_, &count, sizeof(count)) == sizeof(count))
+    {
+    }
+}
+
+// The camera service cannot write to the eventfd itself yet, so a thread
+// turns the ring's own futex wakeups into eventfd events. It sleeps until
+// the producer wakes it; producers that never wake are only polled when
+// there is no SIGUSR1 listener to rely on.
+void ShmemNotifier::watch()
+{
+    while (on_watch_)
+    {
+        bool published = posix_
+            ? WaitPosixShmem(handle_, -1) == POSHMEM_COMM_OK
+            : WaitShmem(handle_, -1) == SHMEM_COMM_OK;
+        if (published && on_watch_)
+        {
+            notify();
+        }
+    }
+    watching_ = false;
+}
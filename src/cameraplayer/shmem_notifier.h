@@ -0,0 +1,35 @@
+#ifndef SHMEM_NOTIFIER_H_
+#define SHMEM_NOTIFIER_H_
+
+#include <atomic>
+#include <thread>
+#include "camshm.h"
+#include "signal_listener.h"
+
+// Makes an eventfd readable whenever the producer publishes a frame on one
+// ring, so frame arrival can be handled by a GSource. Unlike the SIGUSR1
+// notification it replaces, each handle gets its own wakeups, so several
+// pipelines can share a process. Rings whose producer does not wake readers
+// still rely on the service's SIGUSR1, received through the listener.
+class ShmemNotifier
+{
+public:
+    ShmemNotifier();
+    ~ShmemNotifier();
+    bool start(SHMEM_HANDLE handle, bool posix, SignalListener *listener);
+    void stop();
+    void notify();
+    void clear();
+    int fd() const { return fd_; }
+private:
+    int fd_;
+    SHMEM_HANDLE handle_;
+    bool posix_;
+    SignalListener *listener_;
+    std::atomic<bool> on_watch_;
+    std::atomic<bool> watching_;
+    std::thread watch_thread_;
+    void watch();
+};
+
+#endif /* SHMEM_NOTIFIER_H_ */
@@ -10,7 +10,7 @@ SignalListener::SignalListener() :
     on_monitor_(false),
     pid_(-1),
     mutex_{},
-    cond_{}
+    handler_{}
 {
     memset(&option_, 0, sizeof(sig_option_t));
 }
@@ -52,18 +52,10 @@ void SignalListener::quit()
     }
 }
 
-void SignalListener::wait()
+void SignalListener::setHandler(std::function<void()> handler)
 {
-    std::chrono::seconds timeout(option_.timeout.tv_sec);
-    std::unique_lock<std::mutex> mlock(mutex_);
-    if (std::cv_status::timeout == cond_.wait_for(mlock, timeout))
-    {
-        CMP_DEBUG_PRINT("signal wait timeout reached");
-    }
-    else
-    {
-        CMP_DEBUG_PRINT("signal received");
-    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    handler_ = std::move(handler);
 }
 
 void SignalListener::listen()
@@ -74,7 +66,8 @@ void SignalListener::listen()
         if (-1 != sigtimedwait(&option_.set, NULL, &option_.timeout))
         {
             std::lock_guard<std::mutex> guard(mutex_);
-            cond_.notify_one();
+            if (handler_)
+                handler_();
         }
     }
 }
\ No newline at end of file
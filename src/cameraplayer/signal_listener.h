@@ -2,9 +2,12 @@
 #define SIGNAL_LISTENER_H_
 
 #include <signal.h>
-#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <thread>
 
+// Runs a handler for each signal the camera service sends to the pid
+// returned by run(). Used for rings whose producer does not wake readers.
 class SignalListener
 {
 public:
@@ -14,7 +17,7 @@ public:
     void setTimeout(int seconds, int nano_seconds);
     int run();
     void quit();
-    void wait();
+    void setHandler(std::function<void()> handler);
 private:
     struct sig_option_t
     {
@@ -25,7 +28,7 @@ private:
     int pid_;
     sig_option_t option_;
     std::mutex mutex_;
-    std::condition_variable cond_;
+    std::function<void()> handler_;
     std::thread listen_thread_;
     void listen();
 };
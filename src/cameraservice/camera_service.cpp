@@ -146,6 +146,13 @@ void Service::Notify(const gint notification, const gint64 numValue,
             composer.put("paused", mediaInfo);
             break;
         }
+        case CMP_NOTIFY_CAPTURE_COMPLETED:
+        {
+            base::capture_info_t info = *static_cast<base::capture_info_t *>(payload);
+            info.mediaId = media_id_;
+            composer.put("captureCompleted", info);
+            break;
+        }
         case CMP_NOTIFY_ACTIVITY: {
             CMP_DEBUG_PRINT("notifyActivity to resource requestor");
             if (resourceRequestor_)
@@ -248,20 +255,32 @@ bool Service::TakeCameraSnapshotEvent(UMSConnectorHandle *handle,
     }
 
     pbnjson::JValue parsed = jsonparser.getDom();
-    if (!parsed.hasKey("location") && parsed["location"].isString())
+
+    // "shm" delivers each image as a POSIX shm object named in captureCompleted
+    bool shm = parsed.hasKey("delivery") && parsed["delivery"].isString() &&
+               parsed["delivery"].asString() == "shm";
+
+    if (!shm && !parsed.hasKey("location") && parsed["location"].isString())
     {
         CMP_DEBUG_PRINT("id is invalid");
         return false;
     }
-    std::string strLocation = parsed["location"].asString();
+    std::string strLocation = shm ? std::string() : parsed["location"].asString();
 
-    if (strLocation.empty())
+    if (!shm && strLocation.empty())
     {
         CMP_DEBUG_PRINT("InvalidCameraPlayerClient::TakeCameraSnapshot() Error");
         return false;
     }
 
-    return instance_->player_->TakeSnapshot(strLocation);
+    // optional burst: count images, at least interval ms apart
+    int count = 1, interval = 0;
+    if (parsed.hasKey("count") && parsed["count"].isNumber())
+        count = parsed["count"].asNumber<int>();
+    if (parsed.hasKey("interval") && parsed["interval"].isNumber())
+        interval = parsed["interval"].asNumber<int>();
+
+    return instance_->player_->TakeSnapshot(strLocation, count, interval, shm);
 }
 
 bool Service::StartCameraRecordEvent(UMSConnectorHandle *handle,
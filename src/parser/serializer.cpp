@@ -65,6 +65,16 @@ pbnjson::JValue to_json(const base::media_info_t & info) {
   return pbnjson::JObject {{"mediaId", info.mediaId}};
 }
 
+template<>
+pbnjson::JValue to_json(const base::capture_info_t & info) {
+  return pbnjson::JObject {{"index", info.index},
+               {"count", info.count},
+               {"path", info.path},
+               {"size", info.size},
+               {"delivery", info.shm ? "shm" : "file"},
+               {"mediaId", info.mediaId}};
+}
+
 // {"options":{"option":{"windowId":"_Window_Id_1","useSeekableRanges":true,"videoDisplayMode":"Textured","appId":"com.webos.app.mediaevents-test","needAudio":true,"bufferControl":{"userBufferCtrl":false},"transmission":{"httpHeader":{"referer":"https://www.w3.org/2010/05/video/mediaevents.html","userAgent":"Mozilla/5.0 (Web0S; Linux) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/72.0.3626.121 Safari/537.36 WebAppManager","cookies":""}},"preload":"false"}},"id":"_dPG8v3e9kM98mI","uri":"https://media.w3.org/2010/05/sintel/trailer.mp4"}
 template<>
 pbnjson::JValue to_json(const base::load_param_t & load_param) {
@@ -44,6 +44,9 @@ pbnjson::JValue to_json(const base::error_t &);
 template<>
 pbnjson::JValue to_json(const base::media_info_t &);
 
+template<>
+pbnjson::JValue to_json(const base::capture_info_t &);
+
 template<>
 pbnjson::JValue to_json(const base::load_param_t &);
 
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include "cam_posixshm.h"
+
+#define UNIT_SIZE  64
+#define META_SIZE  16
+#define UNIT_NUM   4
+#define EXTRA_SIZE 8
+
+class PosixShmemTest : public ::testing::Test
+{
+protected:
+    SHMEM_HANDLE writer = nullptr;
+    SHMEM_HANDLE reader = nullptr;
+    int fd = -1;
+
+    void SetUp() override
+    {
+        ASSERT_EQ(POSHMEM_COMM_OK,
+                  CreatePosixShmem(&writer, &fd, UNIT_SIZE, META_SIZE, UNIT_NUM, EXTRA_SIZE));
+        ASSERT_EQ(POSHMEM_COMM_OK, OpenPosixShmem(&reader, fd));
+    }
+
+    void TearDown() override
+    {
+        if (reader)
+            ClosePosixShmem(&reader);
+        if (writer)
+            ClosePosixShmem(&writer);
+    }
+
+    POSHMEM_STATUS_T write(const char *data, const char *meta)
+    {
+        return WritePosixShmem(writer, (unsigned char *)data, strlen(data) + 1,
+                               (unsigned char *)meta, strlen(meta) + 1);
+    }
+};
+
+TEST_F(PosixShmemTest, WriteThenRead)
+{
+    unsigned char *data = nullptr;
+    unsigned char *meta = nullptr;
+    int size = 0;
+    int meta_size = 0;
+
+    ASSERT_EQ(POSHMEM_COMM_OK, write("frame1", "meta1"));
+
+    EXPECT_EQ(POSHMEM_COMM_OK, ReadPosixShmem(reader, &data, &size, &meta, &meta_size));
+    EXPECT_EQ((int)sizeof("frame1"), size);
+    EXPECT_STREQ("frame1", (const char *)data);
+    EXPECT_EQ((int)sizeof("meta1"), meta_size);
+    EXPECT_STREQ("meta1", (const char *)meta);
+}
+
+TEST_F(PosixShmemTest, ReadFrameThenValidate)
+{
+    SHMEM_FRAME_T frame;
+
+    EXPECT_EQ(POSHMEM_COMM_NODATA, ReadPosixShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+
+    ASSERT_EQ(POSHMEM_COMM_OK, write("frame1", "meta1"));
+    ASSERT_EQ(POSHMEM_COMM_OK, ReadPosixShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(1ULL, frame.seq);
+    EXPECT_EQ(0ULL, frame.dropped);
+    EXPECT_STREQ("frame1", (const char *)frame.pData);
+    EXPECT_STREQ("meta1", (const char *)frame.pMeta);
+    EXPECT_EQ(EXTRA_SIZE, frame.extraSize);
+    EXPECT_EQ(POSHMEM_COMM_OK, ValidatePosixShmemFrame(reader, &frame));
+
+    // nothing new until the producer writes again
+    EXPECT_EQ(POSHMEM_COMM_NODATA, ReadPosixShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+
+    // a full lap reuses frame 1's slot
+    for (int i = 0; i < UNIT_NUM; i++)
+        ASSERT_EQ(POSHMEM_COMM_OK, write("frameN", "metaN"));
+    EXPECT_EQ(POSHMEM_COMM_OVERFLOW, ReadPosixShmemFrame(reader, SHMEM_READ_SEQ, 1, &frame));
+}
+
+TEST_F(PosixShmemTest, ReaderJoiningALiveRingKeepsItRunning)
+{
+    SHMEM_HANDLE other = nullptr;
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(POSHMEM_COMM_OK, write("frame1", "meta1"));
+    EXPECT_EQ(POSHMEM_COMM_OK, WaitPosixShmem(reader, 0));
+
+    ASSERT_EQ(POSHMEM_COMM_OK, OpenPosixShmem(&other, fd));
+    ASSERT_EQ(POSHMEM_COMM_OK, write("frame2", "meta2"));
+
+    EXPECT_EQ(POSHMEM_COMM_OK, WaitPosixShmem(reader, 50));
+    EXPECT_EQ(POSHMEM_COMM_OK, ReadPosixShmemFrame(reader, SHMEM_READ_SEQ, 1, &frame));
+    EXPECT_STREQ("frame1", (const char *)frame.pData);
+
+    ASSERT_EQ(POSHMEM_COMM_OK, ReadPosixShmemFrame(other, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(1ULL, frame.seq);
+
+    ClosePosixShmem(&other);
+}
+
+TEST_F(PosixShmemTest, ValidateDetectsOverwrite)
+{
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(POSHMEM_COMM_OK, write("frame1", "meta1"));
+    ASSERT_EQ(POSHMEM_COMM_OK, ReadPosixShmemFrame(reader, SHMEM_READ_LATEST, 0, &frame));
+
+    for (int i = 0; i < UNIT_NUM; i++)
+        ASSERT_EQ(POSHMEM_COMM_OK, write("frameN", "metaN"));
+    EXPECT_EQ(POSHMEM_COMM_OVERFLOW, ValidatePosixShmemFrame(reader, &frame));
+}
+
+TEST_F(PosixShmemTest, PinnedFrameOutlivesClose)
+{
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(POSHMEM_COMM_OK, write("frame1", "meta1"));
+    ASSERT_EQ(POSHMEM_COMM_OK, ReadPosixShmemFrame(reader, SHMEM_READ_LATEST, 0, &frame));
+    ASSERT_EQ(POSHMEM_COMM_OK, PinPosixShmemFrame(reader, &frame));
+
+    // the producer skips the leased slot instead of overwriting it
+    for (int i = 0; i < UNIT_NUM; i++)
+        ASSERT_EQ(POSHMEM_COMM_OK, write("frameN", "metaN"));
+    EXPECT_EQ(POSHMEM_COMM_OK, ValidatePosixShmemFrame(reader, &frame));
+
+    SHMEM_HANDLE leased = reader;
+    ASSERT_EQ(POSHMEM_COMM_OK, ClosePosixShmem(&reader));
+    EXPECT_STREQ("frame1", (const char *)frame.pData);
+    EXPECT_EQ(POSHMEM_COMM_OK, UnpinPosixShmemFrame(leased, frame.slot));
+}
+
+TEST_F(PosixShmemTest, WaitReturnsOnWriteAndWake)
+{
+    EXPECT_EQ(POSHMEM_COMM_NODATA, WaitPosixShmem(reader, 10));
+
+    std::thread producer([this]() {
+        usleep(10000);
+        write("frame1", "meta1");
+    });
+    EXPECT_EQ(POSHMEM_COMM_OK, WaitPosixShmem(reader, 5000));
+    producer.join();
+
+    // a wake can land just before the waiter sleeps, so repeat it
+    std::atomic<bool> woken(false);
+    std::thread waker([this, &woken]() {
+        while (!woken)
+        {
+            WakePosixShmem(reader);
+            usleep(1000);
+        }
+    });
+    EXPECT_EQ(POSHMEM_COMM_NODATA, WaitPosixShmem(reader, -1));
+    woken = true;
+    waker.join();
+}
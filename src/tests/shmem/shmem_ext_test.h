@@ -0,0 +1,358 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "camshm.h"
+
+#define UNIT_SIZE  64
+#define META_SIZE  16
+#define UNIT_NUM   4
+#define EXTRA_SIZE 8
+
+// SysV ring with the EXT trailer, one producer and one reader handle
+class ShmemExtTest : public ::testing::Test
+{
+protected:
+    SHMEM_HANDLE writer = nullptr;
+    SHMEM_HANDLE reader = nullptr;
+    key_t key = 0;
+    std::string id;
+    int written = 0;
+
+    void SetUp() override
+    {
+        id = "shmem-ext-test-" + std::to_string(getpid());
+        ASSERT_EQ(SHMEM_COMM_OK, CreateShmemById(&writer, id.c_str(), &key, UNIT_SIZE,
+                                                 META_SIZE, UNIT_NUM, EXTRA_SIZE));
+        ASSERT_EQ(SHMEM_COMM_OK, OpenShmem(&reader, key));
+    }
+
+    void TearDown() override
+    {
+        if (reader)
+            CloseShmem(&reader);
+        if (writer)
+            CloseShmem(&writer);
+    }
+
+    // writes "frame<n>", n counting from 1
+    SHMEM_STATUS_T write()
+    {
+        char data[UNIT_SIZE];
+        int size = snprintf(data, sizeof(data), "frame%d", ++written) + 1;
+        return WriteShmem(writer, (unsigned char *)data, size, nullptr, 0);
+    }
+};
+
+TEST_F(ShmemExtTest, FramesAreNumberedFromOne)
+{
+    SHMEM_FRAME_T frame;
+
+    EXPECT_EQ(SHMEM_COMM_NODATA, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(SHMEM_COMM_OK, write());
+
+    for (unsigned long long seq = 1; seq <= 3; seq++)
+    {
+        ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+        EXPECT_EQ(seq, frame.seq);
+        EXPECT_EQ(0ULL, frame.dropped);
+        EXPECT_EQ("frame" + std::to_string(seq), (const char *)frame.pData);
+    }
+    EXPECT_EQ(SHMEM_COMM_NODATA, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+}
+
+TEST_F(ShmemExtTest, ReadLatestReportsSkippedFrames)
+{
+    SHMEM_FRAME_T frame;
+
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(SHMEM_COMM_OK, write());
+
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_LATEST, 0, &frame));
+    EXPECT_EQ(3ULL, frame.seq);
+    EXPECT_EQ(2ULL, frame.dropped);
+
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(4ULL, frame.seq);
+    EXPECT_EQ(0ULL, frame.dropped);
+}
+
+TEST_F(ShmemExtTest, ReadNextSkipsOverwrittenFrames)
+{
+    SHMEM_FRAME_T frame;
+
+    // frames 1 and 2 are overwritten by 5 and 6
+    for (int i = 0; i < UNIT_NUM + 2; i++)
+        ASSERT_EQ(SHMEM_COMM_OK, write());
+
+    EXPECT_EQ(SHMEM_COMM_OVERFLOW, ReadShmemFrame(reader, SHMEM_READ_SEQ, 1, &frame));
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(3ULL, frame.seq);
+    EXPECT_EQ(2ULL, frame.dropped);
+}
+
+TEST_F(ShmemExtTest, ReadersHaveTheirOwnCursor)
+{
+    SHMEM_HANDLE other = nullptr;
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(SHMEM_COMM_OK, OpenShmem(&other, key));
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(1ULL, frame.seq);
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(other, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(1ULL, frame.seq);
+
+    CloseShmem(&other);
+}
+
+TEST_F(ShmemExtTest, ReaderJoiningALiveRingKeepsItRunning)
+{
+    SHMEM_HANDLE other = nullptr;
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+    EXPECT_EQ(SHMEM_COMM_OK, WaitShmem(reader, 0));
+
+    ASSERT_EQ(SHMEM_COMM_OK, OpenShmem(&other, key));
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+
+    // frame 2 went to the next slot and woke the first reader
+    EXPECT_EQ(SHMEM_COMM_OK, WaitShmem(reader, 50));
+    EXPECT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_SEQ, 1, &frame));
+    EXPECT_STREQ("frame1", (const char *)frame.pData);
+
+    // the new reader starts from the frame on display
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(other, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(1ULL, frame.seq);
+
+    CloseShmem(&other);
+}
+
+TEST_F(ShmemExtTest, ReadBatchDrainsUnreadFrames)
+{
+    SHMEM_FRAME_T frames[UNIT_NUM];
+    int count = 0;
+
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(SHMEM_COMM_OK, write());
+
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemBatch(reader, UNIT_NUM, frames, &count));
+    ASSERT_EQ(3, count);
+    for (int i = 0; i < count; i++)
+        EXPECT_EQ((unsigned long long)i + 1, frames[i].seq);
+    EXPECT_EQ(SHMEM_COMM_NODATA, ReadShmemBatch(reader, UNIT_NUM, frames, &count));
+}
+
+TEST_F(ShmemExtTest, ValidateDetectsOverwrite)
+{
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_LATEST, 0, &frame));
+    EXPECT_EQ(SHMEM_COMM_OK, ValidateShmemFrame(reader, &frame));
+
+    for (int i = 0; i < UNIT_NUM; i++)
+        ASSERT_EQ(SHMEM_COMM_OK, write());
+    EXPECT_EQ(SHMEM_COMM_OVERFLOW, ValidateShmemFrame(reader, &frame));
+}
+
+TEST_F(ShmemExtTest, PinnedSlotIsNotOverwritten)
+{
+    SHMEM_FRAME_T frame;
+    SHMEM_FRAME_T second;
+
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_LATEST, 0, &frame));
+    ASSERT_EQ(SHMEM_COMM_OK, PinShmemFrame(reader, &frame));
+
+    // at most half of the ring can be leased
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_LATEST, 0, &second));
+    EXPECT_EQ(SHMEM_COMM_FAIL, PinShmemFrame(reader, &second));
+
+    for (int i = 0; i < 2 * UNIT_NUM; i++)
+        ASSERT_EQ(SHMEM_COMM_OK, write());
+    EXPECT_EQ(SHMEM_COMM_OK, ValidateShmemFrame(reader, &frame));
+    EXPECT_STREQ("frame1", (const char *)frame.pData);
+
+    EXPECT_EQ(SHMEM_COMM_OK, UnpinShmemFrame(reader, frame.slot));
+    for (int i = 0; i < UNIT_NUM; i++)
+        ASSERT_EQ(SHMEM_COMM_OK, write());
+    EXPECT_EQ(SHMEM_COMM_OVERFLOW, ValidateShmemFrame(reader, &frame));
+}
+
+TEST_F(ShmemExtTest, PinnedFrameOutlivesClose)
+{
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_LATEST, 0, &frame));
+    ASSERT_EQ(SHMEM_COMM_OK, PinShmemFrame(reader, &frame));
+
+    SHMEM_HANDLE leased = reader;
+    ASSERT_EQ(SHMEM_COMM_OK, CloseShmem(&reader));
+    EXPECT_STREQ("frame1", (const char *)frame.pData);
+    EXPECT_EQ(SHMEM_COMM_OK, UnpinShmemFrame(leased, frame.slot));
+}
+
+TEST_F(ShmemExtTest, ClosedHandleTakesNoNewLeases)
+{
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(SHMEM_COMM_OK, write());
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_LATEST, 0, &frame));
+    ASSERT_EQ(SHMEM_COMM_OK, PinShmemFrame(reader, &frame));
+
+    // the first lease keeps the handle alive after the close
+    SHMEM_HANDLE leased = reader;
+    ASSERT_EQ(SHMEM_COMM_OK, CloseShmem(&reader));
+    EXPECT_EQ(SHMEM_COMM_TERMINATE, PinShmemFrame(leased, &frame));
+    EXPECT_EQ(SHMEM_COMM_OK, UnpinShmemFrame(leased, frame.slot));
+}
+
+TEST_F(ShmemExtTest, OpenByIdFindsTheSegment)
+{
+    SHMEM_HANDLE other = nullptr;
+    key_t other_key = 0;
+
+    ASSERT_EQ(SHMEM_COMM_OK, OpenShmemById(&other, id.c_str(), &other_key));
+    EXPECT_EQ(key, other_key);
+    CloseShmem(&other);
+
+    EXPECT_EQ(SHMEM_COMM_FAIL, OpenShmemById(&other, (id + "-none").c_str(), &other_key));
+}
+
+TEST_F(ShmemExtTest, CreateByIdClaimsTheId)
+{
+    SHMEM_HANDLE other = nullptr;
+    key_t other_key = 0;
+
+    EXPECT_EQ(SHMEM_COMM_FAIL, CreateShmemById(&other, id.c_str(), &other_key, UNIT_SIZE,
+                                               META_SIZE, UNIT_NUM, EXTRA_SIZE));
+    EXPECT_EQ(nullptr, other);
+}
+
+TEST_F(ShmemExtTest, ConcurrentCreatorsGetOneSegment)
+{
+    std::string racing = id + "-race";
+
+    for (int i = 0; i < 50; i++)
+    {
+        SHMEM_HANDLE created[2] = {nullptr, nullptr};
+        key_t keys[2] = {0, 0};
+        SHMEM_STATUS_T status[2];
+        std::thread threads[2];
+
+        for (int t = 0; t < 2; t++)
+            threads[t] = std::thread([&, t]() {
+                status[t] = CreateShmemById(&created[t], racing.c_str(), &keys[t], UNIT_SIZE,
+                                            META_SIZE, UNIT_NUM, EXTRA_SIZE);
+            });
+        for (int t = 0; t < 2; t++)
+            threads[t].join();
+
+        EXPECT_EQ(1, (status[0] == SHMEM_COMM_OK) + (status[1] == SHMEM_COMM_OK));
+        for (int t = 0; t < 2; t++)
+        {
+            if (created[t])
+                CloseShmem(&created[t]);
+        }
+    }
+}
+
+// Fills the ring while the reader is lossless, so the next write has to
+// reuse a slot the reader has not read yet.
+class ShmemOverflowTest : public ShmemExtTest
+{
+protected:
+    void SetUp() override
+    {
+        ShmemExtTest::SetUp();
+        ASSERT_EQ(SHMEM_COMM_OK, SetShmemReaderMode(reader, SHMEM_READER_LOSSLESS));
+        for (int i = 0; i < UNIT_NUM; i++)
+            ASSERT_EQ(SHMEM_COMM_OK, write());
+    }
+
+    SHMEM_STATS_T stats()
+    {
+        SHMEM_STATS_T s;
+        memset(&s, 0, sizeof(s));
+        EXPECT_EQ(SHMEM_COMM_OK, GetShmemStats(writer, &s));
+        return s;
+    }
+};
+
+TEST_F(ShmemOverflowTest, DropOldestOverwrites)
+{
+    SHMEM_FRAME_T frame;
+
+    EXPECT_EQ(SHMEM_COMM_OK, write());
+    EXPECT_EQ(1ULL, stats().overwritten);
+
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(2ULL, frame.seq);
+    EXPECT_EQ(1ULL, frame.dropped);
+}
+
+TEST_F(ShmemOverflowTest, DropNewestKeepsUnreadFrames)
+{
+    SHMEM_FRAME_T frame;
+
+    ASSERT_EQ(SHMEM_COMM_OK, SetShmemOverflowPolicy(writer, SHMEM_OVERFLOW_DROP_NEWEST, 0));
+    EXPECT_EQ(SHMEM_COMM_OVERFLOW, write());
+    EXPECT_EQ(1ULL, stats().dropped);
+    EXPECT_EQ((unsigned long long)UNIT_NUM, stats().written);
+    EXPECT_EQ((unsigned long long)UNIT_NUM, stats().last_seq);
+
+    ASSERT_EQ(SHMEM_COMM_OK, ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame));
+    EXPECT_EQ(1ULL, frame.seq);
+    EXPECT_EQ(0ULL, frame.dropped);
+
+    // the slot is free once read
+    EXPECT_EQ(SHMEM_COMM_OK, write());
+}
+
+TEST_F(ShmemOverflowTest, LatestReaderNeverHoldsTheWriter)
+{
+    ASSERT_EQ(SHMEM_COMM_OK, SetShmemOverflowPolicy(writer, SHMEM_OVERFLOW_DROP_NEWEST, 0));
+    ASSERT_EQ(SHMEM_COMM_OK, SetShmemReaderMode(reader, SHMEM_READER_LATEST));
+    EXPECT_EQ(SHMEM_COMM_OK, write());
+    EXPECT_EQ(0ULL, stats().dropped);
+}
+
+TEST_F(ShmemOverflowTest, BlockTimesOut)
+{
+    ASSERT_EQ(SHMEM_COMM_OK, SetShmemOverflowPolicy(writer, SHMEM_OVERFLOW_BLOCK, 20));
+    EXPECT_EQ(SHMEM_COMM_OVERFLOW, write());
+
+    SHMEM_STATS_T s = stats();
+    EXPECT_EQ(1ULL, s.blocked);
+    EXPECT_EQ(1ULL, s.timeouts);
+    EXPECT_EQ(1ULL, s.dropped);
+}
+
+TEST_F(ShmemOverflowTest, BlockResumesWhenTheReaderCatchesUp)
+{
+    std::atomic<bool> read(false);
+
+    ASSERT_EQ(SHMEM_COMM_OK, SetShmemOverflowPolicy(writer, SHMEM_OVERFLOW_BLOCK, -1));
+    std::thread consumer([this, &read]() {
+        SHMEM_FRAME_T frame;
+        usleep(10000);
+        read = ReadShmemFrame(reader, SHMEM_READ_NEXT, 0, &frame) == SHMEM_COMM_OK;
+    });
+    EXPECT_EQ(SHMEM_COMM_OK, write());
+    consumer.join();
+
+    EXPECT_TRUE(read);
+    EXPECT_EQ(1ULL, stats().blocked);
+    EXPECT_EQ(0ULL, stats().timeouts);
+}
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include "cam_posixshm.h"
+#include "camshm_internal.h"
 #include "PmLogLib.h"
 #include "luna-service2/lunaservice.h"
 #include <unistd.h>
@@ -91,6 +92,8 @@ typedef enum _POSHMEM_MARK_T
    meta_size*unit_num  : meta
    4 bytes         : extra_size
    extra_size*unit_num : extra data
+   (8 byte aligned)    : SHMEM_EXT_T, optional (see camshm.cpp)
+   Aligned layouts are described in camshm.cpp.
    */
 
 typedef struct _POSHMEM_COMM_T
@@ -111,6 +114,23 @@ typedef struct _POSHMEM_COMM_T
 
     int *extra_size;
     unsigned char *extra_buf;
+
+    SHMEM_EXT_T *ext;
+
+    /*process local*/
+    unsigned int unit_stride;
+    unsigned int meta_stride;
+    unsigned int extra_stride;
+    unsigned char *base;
+    size_t map_size;
+    int fd; // owned by the handle if it created the segment, -1 otherwise
+    int last_write_index;
+    int last_read_index;
+    int wake_requested;
+    int reader_id;
+    unsigned long long cursor;
+    int refs; // the handle's own plus one per leased frame
+    int closing;
 } POSHMEM_COMM_T;
 
 //  <<Shmem shape : frame_count : 8, extra_size : sizeof(int)) >>
@@ -165,48 +185,66 @@ typedef struct _POSHMEM_COMM_T
 //         LENGTH(sizeof(int) * unit_num) + DATA(meta_size * unit_num) +
 //         EXTRA_SZ(sizeof(int)) + EXTRA_BUF(extra_size * unit_num))
 
-POSHMEM_STATUS_T _OpenPosixShmem(SHMEM_HANDLE *phShmem, int fd, int unitSize, int metaSize,
-                                 int unitNum, int extraSize, int nOpenMode);
+POSHMEM_STATUS_T _OpenPosixShmem(SHMEM_HANDLE *phShmem, int fd, const SHMEM_LAYOUT_T *pLayout,
+                                 int unitSize, int metaSize, int unitNum, int extraSize,
+                                 int nOpenMode);
 POSHMEM_STATUS_T _ReadPosixShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, int *pSize,
                                  unsigned char **ppMeta, int *pMetaSize,
                                  unsigned char **ppExtraData, int *pExtraSize, int readMode);
+static void unmapPosixShmem(POSHMEM_COMM_T *shmem_buffer);
 
 // API functions
 
 extern POSHMEM_STATUS_T OpenPosixShmem(SHMEM_HANDLE *phShmem, int fd)
 {
-    return _OpenPosixShmem(phShmem, fd, 0, 0, 0, 0, MODE_OPEN);
+    return _OpenPosixShmem(phShmem, fd, NULL, 0, 0, 0, 0, MODE_OPEN);
 }
 
-POSHMEM_STATUS_T _OpenPosixShmem(SHMEM_HANDLE *phShmem, int shmfd, int unitSize, int metaSize,
-                                 int unitNum, int extraSize, int nOpenMode)
+POSHMEM_STATUS_T _OpenPosixShmem(SHMEM_HANDLE *phShmem, int shmfd, const SHMEM_LAYOUT_T *pLayout,
+                                 int unitSize, int metaSize, int unitNum, int extraSize,
+                                 int nOpenMode)
 {
     POSHMEM_COMM_T *pShmemBuffer;
     unsigned char *pSharedmem;
-    int shmemSize = 0;
+    size_t shmemSize = 0;
     struct stat sb ;
+    SHMEM_LAYOUT_T layout;
 
-    *phShmem = (SHMEM_HANDLE) malloc(sizeof(POSHMEM_COMM_T));
+    *phShmem = (SHMEM_HANDLE) calloc(1, sizeof(POSHMEM_COMM_T));
     pShmemBuffer = (POSHMEM_COMM_T *) *phShmem;
     if (pShmemBuffer == NULL) {
         CMP_DEBUG_PRINT("pShmemBuffer is null");
         return POSHMEM_COMM_FAIL;
     }
+    pShmemBuffer->fd = -1;
 
     if( fstat (shmfd , &sb) == -1)
     {
         DEBUG_PRINT("Failed to get size of shared memory \n");
+        free(pShmemBuffer);
+        *phShmem = NULL;
         return POSHMEM_COMM_FAIL;
     }
     shmemSize = sb.st_size;
+    if (shmemSize < SHMEM_HEADER_SIZE)
+    {
+        DEBUG_PRINT("shared memory is too small(%zu)\n", shmemSize);
+        free(pShmemBuffer);
+        *phShmem = NULL;
+        return POSHMEM_COMM_FAIL;
+    }
     DEBUG_PRINT("shared memory opened successfully!\n");
 
     pSharedmem = (unsigned char *)mmap(0, shmemSize, PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0);
     if(pSharedmem == MAP_FAILED)
     {
         DEBUG_PRINT("mmap failed \n");
+        free(pShmemBuffer);
+        *phShmem = NULL;
         return POSHMEM_COMM_FAIL;
     }
+    pShmemBuffer->base     = pSharedmem;
+    pShmemBuffer->map_size = shmemSize;
 
     pShmemBuffer->write_index = (int *) (pSharedmem);
     pShmemBuffer->read_index  = (int *) (pSharedmem + sizeof(int));
@@ -215,60 +253,147 @@ POSHMEM_STATUS_T _OpenPosixShmem(SHMEM_HANDLE *phShmem, int shmfd, int unitSize,
     pShmemBuffer->unit_num    = (int *) (pSharedmem + sizeof(int) * 4);
     pShmemBuffer->mark        = (POSHMEM_MARK_T *) (pSharedmem + sizeof(int) * 5);
 
-    size_t length_buf_offset = sizeof(int) * 6;
-
-    size_t data_buf_offset = SHMEM_HEADER_SIZE + (SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
+    if (nOpenMode == MODE_CREATE)
+    {
+        *pShmemBuffer->unit_size = unitSize;
+        *pShmemBuffer->meta_size = metaSize;
+        *pShmemBuffer->unit_num  = unitNum;
+        if (pLayout->magic == SHMEM_LAYOUT_MAGIC)
+            memcpy(pSharedmem + SHMEM_HEADER_SIZE, pLayout, sizeof(*pLayout));
+        *(int *)(pSharedmem + pLayout->extra_size) = extraSize;
+    }
 
-    size_t length_meta_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
+    // a header from a foreign or truncated fd must not send us past the mapping
+    if (shmemReadLayout(&layout, pSharedmem, shmemSize) != 0)
+    {
+        DEBUG_PRINT("invalid header for size %zu\n", shmemSize);
+        munmap(pSharedmem, shmemSize);
+        free(pShmemBuffer);
+        *phShmem = NULL;
+        return POSHMEM_COMM_FAIL;
+    }
+    shmemApplyLayout(pShmemBuffer, pSharedmem, &layout);
 
-    size_t data_meta_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) +
-        (SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
+    pShmemBuffer->reader_id = -1;
+    pShmemBuffer->cursor    = 0;
+    pShmemBuffer->refs      = 1;
+    if (nOpenMode == MODE_CREATE && pShmemBuffer->ext != NULL)
+    {
+        memset(pShmemBuffer->ext, 0, sizeof(SHMEM_EXT_T));
+        pShmemBuffer->ext->unit_num = unitNum;
+        // WriteShmem always wakes readers blocked in WaitShmem
+        pShmemBuffer->ext->flags    = SHMEM_EXT_FLAG_WRITER_WAKES;
+        __atomic_store_n(&pShmemBuffer->ext->magic, SHMEM_EXT_MAGIC, __ATOMIC_RELEASE);
+    }
+    else if (pShmemBuffer->ext != NULL)
+    {
+        SHMEM_EXT_T *ext = pShmemBuffer->ext;
+        if (__atomic_load_n(&ext->magic, __ATOMIC_ACQUIRE) == SHMEM_EXT_MAGIC
+            && ext->unit_num == *pShmemBuffer->unit_num)
+        {
+            unsigned long long last_seq = __atomic_load_n(&ext->last_seq, __ATOMIC_ACQUIRE);
+            pShmemBuffer->cursor    = last_seq ? last_seq : 1;
+            pShmemBuffer->reader_id = shmemRegisterReader(ext, pShmemBuffer->cursor);
+        }
+        else
+        {
+            pShmemBuffer->ext = NULL;
+        }
+    }
 
-    size_t extra_size_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) +
-        ((*pShmemBuffer->meta_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
+    //Until the writter starts to write both write index and read index are
+    //set to -1 . So the reader can get to know that the writter has not
+    //started to write yet. Readers joining a live ring must leave them alone.
+    if (nOpenMode == MODE_CREATE)
+    {
+        *pShmemBuffer->mark = POSHMEM_COMM_MARK_NORMAL;
+        if(pShmemBuffer->write_index) *pShmemBuffer->write_index = -1;
+        if(pShmemBuffer->read_index) *pShmemBuffer->read_index  = -1;
+    }
+    pShmemBuffer->last_write_index = -1;
+    pShmemBuffer->last_read_index  = -1;
+    pShmemBuffer->wake_requested   = 0;
+    DEBUG_PRINT("unitSize = %d, SHMEM_LENGTH_SIZE = %d, unit_num = %d\n",
+            *pShmemBuffer->unit_size, SHMEM_LENGTH_SIZE, *pShmemBuffer->unit_num);
+    DEBUG_PRINT("shared memory opened successfully!\n");
+    return POSHMEM_COMM_OK;
+}
 
-    size_t extra_buf_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) +
-        ((*pShmemBuffer->meta_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) + sizeof(int);
+POSHMEM_STATUS_T CreatePosixShmem(SHMEM_HANDLE *phShmem, int *pFd, int unitSize, int metaSize,
+                                  int unitNum, int extraSize)
+{
+    return CreatePosixShmemEx(phShmem, pFd, unitSize, metaSize, unitNum, extraSize,
+                              SHMEM_LAYOUT_PACKED);
+}
 
-    pShmemBuffer->length_buf = (unsigned int *)(pSharedmem + length_buf_offset);
+// Returns a sized and sealed memfd, or -1.
+static int createSealedMemfd(size_t size, unsigned int memfdFlags)
+{
+    int shmfd = memfd_create("camshm", MFD_CLOEXEC | MFD_ALLOW_SEALING | memfdFlags);
 
-    pShmemBuffer->data_buf = pSharedmem + data_buf_offset;
+    if (shmfd == -1)
+    {
+        DEBUG_PRINT("memfd_create failed : %s\n", strerror(errno));
+        return -1;
+    }
 
-    pShmemBuffer->length_meta = (unsigned int *)(pSharedmem + length_meta_offset);
+    // readers map the whole fd, so its size must never change under them
+    if (ftruncate(shmfd, size) == -1
+        || fcntl(shmfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+    {
+        DEBUG_PRINT("Failed to size shared memory : %s\n", strerror(errno));
+        close(shmfd);
+        return -1;
+    }
+    return shmfd;
+}
 
-    pShmemBuffer->data_meta = pSharedmem + data_meta_offset;
+POSHMEM_STATUS_T CreatePosixShmemEx(SHMEM_HANDLE *phShmem, int *pFd, int unitSize, int metaSize,
+                                    int unitNum, int extraSize, unsigned int layoutFlags)
+{
+    POSHMEM_STATUS_T ret = POSHMEM_COMM_FAIL;
+    SHMEM_LAYOUT_T layout;
+    int shmfd;
 
-    pShmemBuffer->extra_size = NULL;
-    pShmemBuffer->extra_buf  = NULL;
+    if (!phShmem || !pFd || unitSize <= 0 || metaSize < 0 || unitNum <= 0 || extraSize < 0
+        || shmemMakeLayout(&layout, unitSize, metaSize, unitNum, extraSize, layoutFlags) != 0)
+    {
+        DEBUG_PRINT("Invalid argument");
+        return POSHMEM_COMM_FAIL;
+    }
 
-    // shared momory size larger than total, we use extra data
-    if (shmemSize > extra_size_offset)
+    // hugetlbfs only accepts whole huge pages, and mmap() fails when the
+    // pool cannot back them; normal pages still work then
+    if (layoutFlags & SHMEM_LAYOUT_HUGETLB)
     {
-        pShmemBuffer->extra_size = (int *)(pSharedmem + extra_size_offset);
-        pShmemBuffer->extra_buf  = pSharedmem + extra_buf_offset;
+        shmfd = createSealedMemfd(SHMEM_ALIGN((size_t)layout.size, shmemHugePageSize()),
+                                  MFD_HUGETLB);
+        if (shmfd != -1)
+        {
+            ret = _OpenPosixShmem(phShmem, shmfd, &layout, unitSize, metaSize, unitNum,
+                                  extraSize, MODE_CREATE);
+            if (ret != POSHMEM_COMM_OK)
+                close(shmfd);
+        }
     }
-    else
+
+    if (ret != POSHMEM_COMM_OK)
     {
-        pShmemBuffer->extra_size = NULL;
-        pShmemBuffer->extra_buf  = NULL;
+        shmfd = createSealedMemfd(layout.size, 0);
+        if (shmfd == -1)
+            return POSHMEM_COMM_FAIL;
+
+        ret = _OpenPosixShmem(phShmem, shmfd, &layout, unitSize, metaSize, unitNum, extraSize,
+                              MODE_CREATE);
+        if (ret != POSHMEM_COMM_OK)
+        {
+            close(shmfd);
+            return ret;
+        }
     }
-    *pShmemBuffer->mark = POSHMEM_COMM_MARK_NORMAL;
-    //Until the writter starts to write both write index and read index are
-    //set to -1 . So the reader can get to know that the writter has not
-    //started to write yet
-    if(pShmemBuffer->write_index) *pShmemBuffer->write_index = -1;
-    if(pShmemBuffer->read_index) *pShmemBuffer->read_index  = -1;
-    DEBUG_PRINT("unitSize = %d, SHMEM_LENGTH_SIZE = %d, unit_num = %d\n",
-            *pShmemBuffer->unit_size, SHMEM_LENGTH_SIZE, *pShmemBuffer->unit_num);
-    DEBUG_PRINT("shared memory opened successfully!\n");
+
+    ((POSHMEM_COMM_T *) *phShmem)->fd = shmfd;
+    *pFd = shmfd;
     return POSHMEM_COMM_OK;
 }
 
@@ -344,19 +469,19 @@ POSHMEM_STATUS_T _ReadPosixShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, in
                 return POSHMEM_COMM_FAIL;
             }
 
-            read_addr = shmem_buffer->data_buf + (lread_index) * (*shmem_buffer->unit_size);
+            read_addr = shmem_buffer->data_buf + (lread_index) * shmem_buffer->unit_stride;
             *ppData = read_addr;
             *pSize = size;
 
             size       = *(int *)(shmem_buffer->length_meta + lread_index);
-            read_addr  = shmem_buffer->data_meta + (lread_index) * (*shmem_buffer->meta_size);
+            read_addr  = shmem_buffer->data_meta + (lread_index) * shmem_buffer->meta_stride;
             *ppMeta    = read_addr;
             *pMetaSize = size;
 
             if (NULL != ppExtraData && NULL != pExtraSize)
             {
                 *ppExtraData = shmem_buffer->extra_buf
-                    + (lread_index) * (*shmem_buffer->extra_size);
+                    + (lread_index) * shmem_buffer->extra_stride;
                 *pExtraSize = *shmem_buffer->extra_size;
             }
         }
@@ -366,3 +491,234 @@ POSHMEM_STATUS_T _ReadPosixShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, in
 
     return POSHMEM_COMM_OK;
 }
+
+POSHMEM_STATUS_T WritePosixShmem(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSize,
+                                 unsigned char *pMeta, int metaSize)
+{
+    return WritePosixShmemEx(hShmem, pData, dataSize, pMeta, metaSize, NULL, 0);
+}
+
+POSHMEM_STATUS_T WritePosixShmemEx(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSize,
+                                   unsigned char *pMeta, int metaSize, unsigned char *pExtraData,
+                                   int extraDataSize)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pData)
+    {
+        DEBUG_PRINT("Invalid argument");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    if ((dataSize == 0) || (dataSize > *shmem_buffer->unit_size))
+    {
+        DEBUG_PRINT("size error(%d > %d)!\n", dataSize, *shmem_buffer->unit_size);
+        return POSHMEM_COMM_FAIL;
+    }
+
+    switch (shmemWriteFrame(shmem_buffer, pData, dataSize, pMeta, metaSize, pExtraData,
+                            extraDataSize))
+    {
+    case SHMEM_COMM_OK:
+        return POSHMEM_COMM_OK;
+    case SHMEM_COMM_OVERFLOW:
+        return POSHMEM_COMM_OVERFLOW;
+    default:
+        return POSHMEM_COMM_FAIL;
+    }
+}
+
+POSHMEM_STATUS_T WaitPosixShmem(SHMEM_HANDLE hShmem, int timeoutMs)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer)
+    {
+        DEBUG_PRINT("shmem buffer is NULL");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    bool writer_wakes = shmem_buffer->ext != NULL
+                        && (shmem_buffer->ext->flags & SHMEM_EXT_FLAG_WRITER_WAKES);
+    if (shmemWaitWriteIndex(shmem_buffer->write_index, &shmem_buffer->last_write_index,
+                            timeoutMs, writer_wakes, &shmem_buffer->wake_requested) != 0)
+    {
+        return POSHMEM_COMM_NODATA;
+    }
+
+    return POSHMEM_COMM_OK;
+}
+
+POSHMEM_STATUS_T WakePosixShmem(SHMEM_HANDLE hShmem)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer)
+    {
+        DEBUG_PRINT("shmem_buffer is NULL\n");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    shmemWakeWaiters(shmem_buffer->write_index, &shmem_buffer->wake_requested);
+    return POSHMEM_COMM_OK;
+}
+
+POSHMEM_STATUS_T GetPosixShmemWriterWakes(SHMEM_HANDLE hShmem)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || shmem_buffer->ext == NULL
+        || !(shmem_buffer->ext->flags & SHMEM_EXT_FLAG_WRITER_WAKES))
+    {
+        return POSHMEM_COMM_FAIL;
+    }
+
+    return POSHMEM_COMM_OK;
+}
+
+POSHMEM_STATUS_T ReadPosixShmemFrame(SHMEM_HANDLE hShmem, SHMEM_READ_MODE_T readMode,
+                                     unsigned long long seq, SHMEM_FRAME_T *pFrame)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pFrame)
+    {
+        DEBUG_PRINT("Invalid argument");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    switch (shmemReadFrame(shmem_buffer, readMode, seq, pFrame))
+    {
+    case SHMEM_COMM_OK:
+        return POSHMEM_COMM_OK;
+    case SHMEM_COMM_NODATA:
+        return POSHMEM_COMM_NODATA;
+    case SHMEM_COMM_OVERFLOW:
+        return POSHMEM_COMM_OVERFLOW;
+    default:
+        return POSHMEM_COMM_FAIL;
+    }
+}
+
+POSHMEM_STATUS_T ReadPosixShmemBatch(SHMEM_HANDLE hShmem, int maxFrames, SHMEM_FRAME_T *pFrames,
+                                     int *pCount)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || maxFrames <= 0 || !pFrames || !pCount)
+    {
+        DEBUG_PRINT("Invalid argument");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    switch (shmemReadBatch(shmem_buffer, maxFrames, pFrames, pCount))
+    {
+    case SHMEM_COMM_OK:
+        return POSHMEM_COMM_OK;
+    case SHMEM_COMM_NODATA:
+        return POSHMEM_COMM_NODATA;
+    default:
+        return POSHMEM_COMM_FAIL;
+    }
+}
+
+POSHMEM_STATUS_T ValidatePosixShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pFrame)
+    {
+        DEBUG_PRINT("Invalid argument");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    if (shmemValidateFrame(shmem_buffer, pFrame) != SHMEM_COMM_OK)
+        return POSHMEM_COMM_OVERFLOW;
+    return POSHMEM_COMM_OK;
+}
+
+POSHMEM_STATUS_T PinPosixShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pFrame)
+    {
+        DEBUG_PRINT("Invalid argument");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    switch (shmemPinFrame(shmem_buffer, pFrame, unmapPosixShmem))
+    {
+    case SHMEM_COMM_OK:
+        return POSHMEM_COMM_OK;
+    case SHMEM_COMM_OVERFLOW:
+        return POSHMEM_COMM_OVERFLOW;
+    case SHMEM_COMM_TERMINATE:
+        return POSHMEM_COMM_TERMINATE;
+    default:
+        return POSHMEM_COMM_FAIL;
+    }
+}
+
+static void unmapPosixShmem(POSHMEM_COMM_T *shmem_buffer)
+{
+    if (shmem_buffer->ext != NULL)
+        shmemUnregisterReader(shmem_buffer->ext, shmem_buffer->reader_id);
+
+    munmap(shmem_buffer->base, shmem_buffer->map_size);
+    if (shmem_buffer->fd != -1)
+        close(shmem_buffer->fd);
+
+    free(shmem_buffer);
+}
+
+POSHMEM_STATUS_T UnpinPosixShmemFrame(SHMEM_HANDLE hShmem, int slot)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || shmem_buffer->ext == NULL || shmem_buffer->reader_id < 0
+        || slot < 0 || slot >= *shmem_buffer->unit_num)
+    {
+        DEBUG_PRINT("Invalid argument");
+        return POSHMEM_COMM_FAIL;
+    }
+
+    shmemUnpinSlot(shmem_buffer, slot, unmapPosixShmem);
+    return POSHMEM_COMM_OK;
+}
+
+POSHMEM_STATUS_T SetPosixShmemReaderMode(SHMEM_HANDLE hShmem, SHMEM_READER_MODE_T mode)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || shmemSetReaderMode(shmem_buffer, mode) != SHMEM_COMM_OK)
+        return POSHMEM_COMM_FAIL;
+    return POSHMEM_COMM_OK;
+}
+
+POSHMEM_STATUS_T GetPosixShmemStats(SHMEM_HANDLE hShmem, SHMEM_STATS_T *pStats)
+{
+    POSHMEM_COMM_T *shmem_buffer = (POSHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pStats || shmemGetStats(shmem_buffer, pStats) != SHMEM_COMM_OK)
+        return POSHMEM_COMM_FAIL;
+    return POSHMEM_COMM_OK;
+}
+
+POSHMEM_STATUS_T ClosePosixShmem(SHMEM_HANDLE *phShmem)
+{
+    POSHMEM_COMM_T *shmem_buffer;
+
+    if (!phShmem || !*phShmem)
+    {
+        DEBUG_PRINT("shmem buffer is NULL");
+        return POSHMEM_COMM_FAIL;
+    }
+    shmem_buffer = (POSHMEM_COMM_T *) *phShmem;
+
+    __atomic_store_n(&shmem_buffer->closing, 1, __ATOMIC_SEQ_CST);
+    shmemUnref(shmem_buffer, unmapPosixShmem);
+
+    *phShmem = NULL;
+    return POSHMEM_COMM_OK;
+}
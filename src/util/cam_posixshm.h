@@ -17,6 +17,8 @@
 #ifndef SRC_HAL_UTILS_POCAMSHM_H_
 #define SRC_HAL_UTILS_POCAMSHM_H_
 
+#include "camshm.h"
+
 typedef enum _POSHMEM_STATUS_T
 {
     POSHMEM_COMM_OK        = 0x0,
@@ -28,6 +30,16 @@ typedef enum _POSHMEM_STATUS_T
 
 typedef void * SHMEM_HANDLE;
 
+// Creates a sealed memfd-backed ring and returns its fd in pFd, to be passed
+// to readers (e.g. over a unix socket) and opened with OpenPosixShmem(). The
+// fd belongs to the handle and is closed by ClosePosixShmem().
+extern POSHMEM_STATUS_T CreatePosixShmem(SHMEM_HANDLE *phShmem, int *pFd, int unitSize,
+                                         int metaSize, int unitNum, int extraSize);
+// layoutFlags is a mask of SHMEM_LAYOUT_FLAGS_T.
+extern POSHMEM_STATUS_T CreatePosixShmemEx(SHMEM_HANDLE *phShmem, int *pFd, int unitSize,
+                                           int metaSize, int unitNum, int extraSize,
+                                           unsigned int layoutFlags);
+// The mapping does not depend on fd, which stays owned by the caller.
 extern POSHMEM_STATUS_T OpenPosixShmem(SHMEM_HANDLE *phShmem, int fd);
 extern POSHMEM_STATUS_T ReadPosixShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, int *pSize,
                                        unsigned char **ppMeta, int *pMetaSize);
@@ -39,5 +51,36 @@ extern POSHMEM_STATUS_T ReadPosixLastShmem(SHMEM_HANDLE hShmem, unsigned char **
 extern POSHMEM_STATUS_T ReadPosixLastShmemEx(SHMEM_HANDLE hShmem, unsigned char **ppData,
                                           unsigned char **ppMeta, int *pMetaSize,
                                           int *pSize, unsigned char **ppExtraData, int *pExtraSize);
+extern POSHMEM_STATUS_T WritePosixShmem(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSize,
+                                        unsigned char *pMeta, int metaSize);
+extern POSHMEM_STATUS_T WritePosixShmemEx(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSize,
+                                          unsigned char *pMeta, int metaSize,
+                                          unsigned char *pExtraData, int extraDataSize);
+// Unmaps the ring, deferred until every leased frame has been unpinned.
+extern POSHMEM_STATUS_T ClosePosixShmem(SHMEM_HANDLE *phShmem);
+
+// Blocks until the producer publishes a frame this handle has not waited for
+// yet. timeoutMs < 0 waits forever. Returns POSHMEM_COMM_NODATA on timeout.
+extern POSHMEM_STATUS_T WaitPosixShmem(SHMEM_HANDLE hShmem, int timeoutMs);
+
+// Makes a WaitPosixShmem on this handle in another thread return POSHMEM_COMM_NODATA,
+// or the next one if none is waiting yet.
+extern POSHMEM_STATUS_T WakePosixShmem(SHMEM_HANDLE hShmem);
+
+// Returns POSHMEM_COMM_OK if the producer wakes WaitPosixShmem() when it
+// publishes a frame, POSHMEM_COMM_FAIL if waiting falls back to polling.
+extern POSHMEM_STATUS_T GetPosixShmemWriterWakes(SHMEM_HANDLE hShmem);
+
+// Same as ReadShmemFrame(), ReadShmemBatch(), ValidateShmemFrame(),
+// PinShmemFrame() and UnpinShmemFrame() in camshm.h, for POSIX shared memory.
+extern POSHMEM_STATUS_T ReadPosixShmemFrame(SHMEM_HANDLE hShmem, SHMEM_READ_MODE_T readMode,
+                                            unsigned long long seq, SHMEM_FRAME_T *pFrame);
+extern POSHMEM_STATUS_T ReadPosixShmemBatch(SHMEM_HANDLE hShmem, int maxFrames,
+                                            SHMEM_FRAME_T *pFrames, int *pCount);
+extern POSHMEM_STATUS_T ValidatePosixShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame);
+extern POSHMEM_STATUS_T PinPosixShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame);
+extern POSHMEM_STATUS_T UnpinPosixShmemFrame(SHMEM_HANDLE hShmem, int slot);
+extern POSHMEM_STATUS_T SetPosixShmemReaderMode(SHMEM_HANDLE hShmem, SHMEM_READER_MODE_T mode);
+extern POSHMEM_STATUS_T GetPosixShmemStats(SHMEM_HANDLE hShmem, SHMEM_STATS_T *pStats);
 
 #endif //SRC_HAL_UTILS_POCAMSHM_H_
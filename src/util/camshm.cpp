@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include "camshm.h"
+#include "camshm_internal.h"
 
 //#define SHMEM_COMM_DEBUG
 
@@ -39,6 +40,14 @@
 
 #define CAMSHKEY 7010
 
+// Keys derived from an id live outside the legacy CAMSHKEY range. A short
+// probe sequence absorbs hash collisions between ids.
+#define CAMSHKEY_ID_BASE 0x43000000
+#define CAMSHKEY_ID_MASK 0x00FFFFFF
+#define SHMEM_KEY_PROBES 8
+// Semaphores that serialize the creators of one id
+#define CAMSHKEY_LOCK_BASE 0x44000000
+
 #define SHMEM_HEADER_SIZE (6 * sizeof(int))
 #define SHMEM_LENGTH_SIZE sizeof(int)
 
@@ -84,6 +93,16 @@ typedef enum _SHMEM_MARK_T
  meta_size*unit_num  : meta
  4 bytes             : extra_size
  extra_size*unit_num : extra data
+ (8 byte aligned)    : SHMEM_EXT_T, optional
+
+ aligned layouts (SHMEM_LAYOUT_CACHE_ALIGNED / SHMEM_LAYOUT_PAGE_ALIGNED)
+ 24 bytes            : header as above
+ SHMEM_LAYOUT_T      : offsets and strides of everything below
+ 4 bytes  *unit_num  : length data
+ 4 bytes  *unit_num  : length meta
+ 4 bytes             : extra_size
+ stride   *unit_num  : data, meta, extra data, each slot aligned
+ (aligned)           : SHMEM_EXT_T, optional
  */
 
 typedef struct _SHMEM_COMM_T
@@ -107,6 +126,20 @@ typedef struct _SHMEM_COMM_T
 
     int *extra_size;
     unsigned char *extra_buf;
+
+    SHMEM_EXT_T *ext;
+
+    /*process local*/
+    unsigned int unit_stride;
+    unsigned int meta_stride;
+    unsigned int extra_stride;
+    int last_write_index;
+    int last_read_index;
+    int wake_requested;
+    int reader_id;
+    unsigned long long cursor;
+    int refs; // the handle's own plus one per leased frame
+    int closing;
 } SHMEM_COMM_T;
 
 //  <<Shmem shape : frame_count : 8, extra_size : sizeof(int)) >>
@@ -159,16 +192,23 @@ typedef struct _SHMEM_COMM_T
 // TOTAL = HEADER(24) +
 //         LENGTH(sizeof(int) * unit_num) + DATA(unit_size * unit_num) +
 //         LENGTH(sizeof(int) * unit_num) + DATA(meta_size * unit_num) +
-//         EXTRA_SZ(sizeof(int)) + EXTRA_BUF(extra_size * unit_num))
+//         EXTRA_SZ(sizeof(int)) + EXTRA_BUF(extra_size * unit_num)) +
+//         EXT(sizeof(SHMEM_EXT_T), aligned to 8, only if unit_num <= SHMEM_MAX_UNITS)
+//
+// The EXT trailer carries per-slot frame sequence numbers and the reader
+// cursor table. Producers that predate it simply do not allocate it; it is
+// detected from the segment size and its magic word.
 
-SHMEM_STATUS_T _OpenShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize, int metaSize,
-                          int unitNum, int extraSize, int nOpenMode);
+SHMEM_STATUS_T _OpenShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, const char *id, int unitSize,
+                          int metaSize, int unitNum, int extraSize, unsigned int layoutFlags,
+                          int nOpenMode);
 SHMEM_STATUS_T _ReadShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, int *pSize,
                           unsigned char **ppMeta, int *pMetaSize, unsigned char **ppExtraData,
                           int *pExtraSize, int readMode);
 SHMEM_STATUS_T _WriteShmem(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSize,
                            unsigned char *pMeta, int metaSize, unsigned char *pExtraData,
                            int extraDataSize);
+static void detachShmem(SHMEM_COMM_T *shmem_buffer);
 
 // Internal Functions
 
@@ -246,27 +286,224 @@ int increseReadIndex(SHMEM_COMM_T *pShmem_buffer, int lread_index)
     return lread_index;
 }
 
+// FNV-1a, never 0 so that 0 can mean "no id"
+static unsigned int hashShmemId(const char *id)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *id; id++)
+    {
+        hash ^= (unsigned char) *id;
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static key_t idToShmemKey(const char *id)
+{
+    return (key_t) (CAMSHKEY_ID_BASE | (hashShmemId(id) & CAMSHKEY_ID_MASK));
+}
+
+// Locates the EXT trailer from the header of an attached segment, or NULL
+// if the segment is too small to carry one.
+static SHMEM_EXT_T *findShmemExt(unsigned char *pSharedmem, size_t segSize)
+{
+    SHMEM_LAYOUT_T layout;
+
+    if (shmemReadLayout(&layout, pSharedmem, segSize) != 0 || layout.ext == 0)
+        return NULL;
+    return (SHMEM_EXT_T *) (pSharedmem + layout.ext);
+}
+
+static bool isShmemOwnedBy(key_t shmemKey, unsigned int idHash)
+{
+    struct shmid_ds shm_stat;
+    unsigned char *pSharedmem;
+    SHMEM_EXT_T *ext;
+    bool owned;
+    int shmem_id = shmget(shmemKey, 0, 0666);
+
+    if (shmem_id == -1 || shmctl(shmem_id, IPC_STAT, &shm_stat) == -1)
+        return false;
+    pSharedmem = (unsigned char *) shmat(shmem_id, NULL, SHM_RDONLY);
+    if (pSharedmem == (void *) -1)
+        return false;
+
+    ext   = findShmemExt(pSharedmem, shm_stat.shm_segsz);
+    owned = ext != NULL && __atomic_load_n(&ext->magic, __ATOMIC_ACQUIRE) == SHMEM_EXT_MAGIC
+            && ext->id_hash == idHash;
+    shmdt(pSharedmem);
+    return owned;
+}
+
+// A segment is only recognisable as an id's once its EXT trailer is written,
+// so creators of the same id take this lock from the key claim until then.
+// Otherwise a second creator could probe past a segment still being set up
+// and claim another key for the same id. The semaphore is free at 0, so
+// whoever creates it needs no initialization, and SEM_UNDO releases it if
+// the holder dies. Releasing removes it; waiters then race for a new one.
+static int lockShmemId(unsigned int idHash)
+{
+    struct sembuf sema_buffer[2];
+    key_t lockKey = (key_t) (CAMSHKEY_LOCK_BASE | (idHash & CAMSHKEY_ID_MASK));
+
+    sema_buffer[0].sem_num = 0;
+    sema_buffer[0].sem_op  = 0;
+    sema_buffer[0].sem_flg = 0;
+    sema_buffer[1].sem_num = 0;
+    sema_buffer[1].sem_op  = 1;
+    sema_buffer[1].sem_flg = SEM_UNDO;
+
+    while (1)
+    {
+        int sema_id = semget(lockKey, 1, 0666 | IPC_CREAT);
+
+        if (sema_id == -1)
+            return -1;
+        if (semop(sema_id, sema_buffer, 2) == 0)
+            return sema_id;
+        if (errno != EINTR && errno != EIDRM && errno != EINVAL)
+            return -1;
+    }
+}
+
+static void unlockShmemId(int sema_id)
+{
+    if (sema_id != -1)
+        semctl(sema_id, 0, IPC_RMID, NULL);
+}
+
+// Removes a segment nobody is attached to whose creator has exited, e.g. one
+// left behind by a producer that crashed before CloseShmem().
+static bool removeStaleShmem(key_t shmemKey)
+{
+    struct shmid_ds shm_stat;
+    int shmem_id = shmget(shmemKey, 0, 0666);
+    int sema_id;
+
+    if (shmem_id == -1 || shmctl(shmem_id, IPC_STAT, &shm_stat) == -1)
+        return false;
+    if (shm_stat.shm_nattch != 0 || !(kill(shm_stat.shm_cpid, 0) == -1 && errno == ESRCH))
+        return false;
+
+    DEBUG_PRINT("removing stale segment for key %d\n", shmemKey);
+    if ((sema_id = semget(shmemKey, 1, 0666)) != -1)
+        semctl(sema_id, 0, IPC_RMID, NULL);
+    return shmctl(shmem_id, IPC_RMID, NULL) == 0;
+}
+
+// Creates the segment under the first free key of the probe sequence.
+// IPC_EXCL makes each attempt an atomic claim, so two producers starting at
+// the same time can never end up sharing a key.
+// With an idHash, a live segment already created for the same id makes the
+// claim fail instead of moving on to the next key.
+static int claimShmemKey(key_t firstKey, int probes, int shmemSize, int shmFlags,
+                         unsigned int idHash, key_t *pShmemKey)
+{
+    for (int i = 0; i < probes; i++)
+    {
+        key_t shmemKey = firstKey + i;
+        int shmem_id = shmget(shmemKey, shmemSize, 0666 | IPC_CREAT | IPC_EXCL | shmFlags);
+
+        if (shmem_id == -1 && errno == EEXIST && idHash != 0)
+        {
+            if (removeStaleShmem(shmemKey))
+            {
+                shmem_id = shmget(shmemKey, shmemSize, 0666 | IPC_CREAT | IPC_EXCL | shmFlags);
+            }
+            else if (isShmemOwnedBy(shmemKey, idHash))
+            {
+                DEBUG_PRINT("key %d is already in use by the same id\n", shmemKey);
+                errno = EEXIST;
+                return -1;
+            }
+        }
+
+        if (shmem_id != -1)
+        {
+            *pShmemKey = shmemKey;
+            return shmem_id;
+        }
+        if (errno != EEXIST)
+            return -1;
+    }
+    errno = EEXIST;
+    return -1;
+}
+
 // API functions
 
 SHMEM_STATUS_T CreateShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize, int metaSize,
                            int unitNum)
 {
-    return _OpenShmem(phShmem, pShmemKey, unitSize, metaSize, unitNum, 0, MODE_CREATE);
+    return _OpenShmem(phShmem, pShmemKey, NULL, unitSize, metaSize, unitNum, 0,
+                      SHMEM_LAYOUT_PACKED, MODE_CREATE);
 }
 
 SHMEM_STATUS_T CreateShmemEx(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize, int metaSize,
                              int unitNum, int extraSize)
 {
-    return _OpenShmem(phShmem, pShmemKey, unitSize, metaSize, unitNum, extraSize, MODE_CREATE);
+    return _OpenShmem(phShmem, pShmemKey, NULL, unitSize, metaSize, unitNum, extraSize,
+                      SHMEM_LAYOUT_PACKED, MODE_CREATE);
+}
+
+SHMEM_STATUS_T CreateShmemById(SHMEM_HANDLE *phShmem, const char *id, key_t *pShmemKey,
+                               int unitSize, int metaSize, int unitNum, int extraSize)
+{
+    return CreateShmemByIdEx(phShmem, id, pShmemKey, unitSize, metaSize, unitNum, extraSize,
+                             SHMEM_LAYOUT_PACKED);
+}
+
+SHMEM_STATUS_T CreateShmemByIdEx(SHMEM_HANDLE *phShmem, const char *id, key_t *pShmemKey,
+                                 int unitSize, int metaSize, int unitNum, int extraSize,
+                                 unsigned int layoutFlags)
+{
+    if (id == NULL || *id == '\0')
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+    return _OpenShmem(phShmem, pShmemKey, id, unitSize, metaSize, unitNum, extraSize,
+                      layoutFlags, MODE_CREATE);
 }
 
 extern SHMEM_STATUS_T OpenShmem(SHMEM_HANDLE *phShmem, key_t shmemKey)
 {
-    return _OpenShmem(phShmem, &shmemKey, 0, 0, 0, 0, MODE_OPEN);
+    return _OpenShmem(phShmem, &shmemKey, NULL, 0, 0, 0, 0, 0, MODE_OPEN);
+}
+
+SHMEM_STATUS_T OpenShmemById(SHMEM_HANDLE *phShmem, const char *id, key_t *pShmemKey)
+{
+    key_t firstKey;
+
+    if (id == NULL || *id == '\0')
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    firstKey = idToShmemKey(id);
+    for (int i = 0; i < SHMEM_KEY_PROBES; i++)
+    {
+        key_t shmemKey = firstKey + i;
+
+        if (shmget(shmemKey, 0, 0666) == -1)
+            continue;
+        if (_OpenShmem(phShmem, &shmemKey, id, 0, 0, 0, 0, 0, MODE_OPEN) == SHMEM_COMM_OK)
+        {
+            if (pShmemKey != NULL)
+                *pShmemKey = shmemKey;
+            return SHMEM_COMM_OK;
+        }
+    }
+
+    DEBUG_PRINT("no segment for id %s\n", id);
+    return SHMEM_COMM_FAIL;
 }
 
-SHMEM_STATUS_T _OpenShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize, int metaSize,
-                          int unitNum, int extraSize, int nOpenMode)
+SHMEM_STATUS_T _OpenShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, const char *id, int unitSize,
+                          int metaSize, int unitNum, int extraSize, unsigned int layoutFlags,
+                          int nOpenMode)
 {
     SHMEM_COMM_T *pShmemBuffer;
     unsigned char *pSharedmem;
@@ -274,6 +511,10 @@ SHMEM_STATUS_T _OpenShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize,
     int shmemSize = 0;
     int shmemMode = 0666;
     struct shmid_ds shm_stat;
+    size_t segSize = 0;
+    unsigned int idHash = id ? hashShmemId(id) : 0;
+    int id_lock = -1;
+    SHMEM_LAYOUT_T layout;
 
     *phShmem = (SHMEM_HANDLE) calloc(1, sizeof(SHMEM_COMM_T));
     pShmemBuffer = (SHMEM_COMM_T *) *phShmem;
@@ -287,29 +528,68 @@ SHMEM_STATUS_T _OpenShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize,
 
     if (nOpenMode == MODE_CREATE)
     {
-        for (shmemKey = CAMSHKEY; shmemKey < 0xFFFF; shmemKey++)
+        if (unitSize <= 0 || metaSize < 0 || unitNum <= 0 || extraSize < 0
+            || shmemMakeLayout(&layout, unitSize, metaSize, unitNum, extraSize, layoutFlags) != 0
+            || layout.size > INT_MAX)
         {
-            pShmemBuffer->shmem_id = shmget((key_t) shmemKey, 0, 0666);
-            if (pShmemBuffer->shmem_id == -1 && errno == ENOENT)
-                break;
+            DEBUG_PRINT("Invalid argument\n");
+            free(pShmemBuffer);
+            *phShmem = NULL;
+            return SHMEM_COMM_FAIL;
         }
-        *pShmemKey = shmemKey;
-        shmemSize = SHMEM_HEADER_SIZE + (unitSize + SHMEM_LENGTH_SIZE) * unitNum + sizeof(int)
-                + extraSize * unitNum;
+        shmemSize = layout.size;
         shmemMode |= IPC_CREAT | IPC_EXCL;
+
+        if (id != NULL && (id_lock = lockShmemId(idHash)) == -1)
+        {
+            DEBUG_PRINT("Can't lock id %s : %s\n", id, strerror(errno));
+            free(pShmemBuffer);
+            *phShmem = NULL;
+            return SHMEM_COMM_FAIL;
+        }
+
+        pShmemBuffer->shmem_id = -1;
+        if (layoutFlags & SHMEM_LAYOUT_HUGETLB)
+        {
+            int hugeSize = SHMEM_ALIGN((size_t)shmemSize, shmemHugePageSize());
+
+            if (id != NULL)
+                pShmemBuffer->shmem_id = claimShmemKey(idToShmemKey(id), SHMEM_KEY_PROBES,
+                                                       hugeSize, SHM_HUGETLB, idHash, &shmemKey);
+            else
+                pShmemBuffer->shmem_id = claimShmemKey(CAMSHKEY, 0xFFFF - CAMSHKEY, hugeSize,
+                                                       SHM_HUGETLB, 0, &shmemKey);
+            // no huge pages reserved or not permitted; normal pages still work
+            if (pShmemBuffer->shmem_id == -1 && errno != EEXIST)
+                DEBUG_PRINT("SHM_HUGETLB failed : %s\n", strerror(errno));
+        }
+
+        if (pShmemBuffer->shmem_id == -1)
+        {
+            if (id != NULL)
+                pShmemBuffer->shmem_id = claimShmemKey(idToShmemKey(id), SHMEM_KEY_PROBES,
+                                                       shmemSize, 0, idHash, &shmemKey);
+            else
+                pShmemBuffer->shmem_id = claimShmemKey(CAMSHKEY, 0xFFFF - CAMSHKEY, shmemSize,
+                                                       0, 0, &shmemKey);
+        }
+        if (pShmemBuffer->shmem_id != -1)
+            *pShmemKey = shmemKey;
     }
     else
     {
         shmemKey = *pShmemKey;
+        pShmemBuffer->shmem_id = shmget((key_t) shmemKey, shmemSize, shmemMode);
     }
 
     DEBUG_PRINT("shmem_key=%d\r\n", shmemKey);
 
-    pShmemBuffer->shmem_id = shmget((key_t) shmemKey, shmemSize, shmemMode);
     if (pShmemBuffer->shmem_id == -1)
     {
         DEBUG_PRINT("Can't open shared memory: %s\n", strerror(errno));
+        unlockShmemId(id_lock);
         free(pShmemBuffer);
+        *phShmem = NULL;
         return SHMEM_COMM_FAIL;
     }
 
@@ -332,86 +612,120 @@ SHMEM_STATUS_T _OpenShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize,
         if ((pShmemBuffer->sema_id = semget((key_t) shmemKey, 1, 0666)) == -1)
         {
             DEBUG_PRINT("Failed to get semaphore : %s\n", strerror(errno));
+            shmdt(pSharedmem);
+            if (nOpenMode == MODE_CREATE)
+            {
+                // give back the key this call claimed
+                shmctl(pShmemBuffer->shmem_id, IPC_RMID, NULL);
+                unlockShmemId(id_lock);
+            }
             free(pShmemBuffer);
+            *phShmem = NULL;
             return SHMEM_COMM_FAIL;
         }
     }
 
+    if (shmctl(pShmemBuffer->shmem_id, IPC_STAT, &shm_stat) != -1)
+    {
+#ifdef SHMEM_COMM_DEBUG
+        DEBUG_PRINT("shm_stat.shm_nattch=%d\n", (int)shm_stat.shm_nattch);
+        if (shm_stat.shm_nattch == 1)
+            DEBUG_PRINT("we are the first client\n");
+
+        DEBUG_PRINT("shared memory size = %d\n", shm_stat.shm_segsz);
+#endif
+        segSize = shm_stat.shm_segsz;
+    }
+
     if (nOpenMode == MODE_CREATE)
     {
         *pShmemBuffer->unit_size = unitSize;
         *pShmemBuffer->meta_size = metaSize;
         *pShmemBuffer->unit_num  = unitNum;
+        if (layout.magic == SHMEM_LAYOUT_MAGIC)
+            memcpy(pSharedmem + SHMEM_HEADER_SIZE, &layout, sizeof(layout));
+        *(int *)(pSharedmem + layout.extra_size) = extraSize;
     }
-    size_t length_buf_offset = sizeof(int) * 6;
-
-    size_t data_buf_offset = SHMEM_HEADER_SIZE + (SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
-
-    size_t length_meta_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
-
-    size_t data_meta_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) +
-        (SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
-
-    size_t extra_size_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) +
-        ((*pShmemBuffer->meta_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num);
-
-    size_t extra_buf_offset =
-        SHMEM_HEADER_SIZE +
-        ((*pShmemBuffer->unit_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) +
-        ((*pShmemBuffer->meta_size) + SHMEM_LENGTH_SIZE) * (*pShmemBuffer->unit_num) + sizeof(int);
-
-    pShmemBuffer->length_buf = (unsigned int *)(pSharedmem + length_buf_offset);
 
-    pShmemBuffer->data_buf = pSharedmem + data_buf_offset;
-
-    pShmemBuffer->length_meta = (unsigned int *)(pSharedmem + length_meta_offset);
-
-    pShmemBuffer->data_meta = pSharedmem + data_meta_offset;
+    if (shmemReadLayout(&layout, pSharedmem, segSize) != 0)
+    {
+        DEBUG_PRINT("invalid header for segment size %zu\n", segSize);
+        shmdt(pSharedmem);
+        if (nOpenMode == MODE_CREATE)
+        {
+            // give back the key this call claimed
+            semctl(pShmemBuffer->sema_id, 0, IPC_RMID, NULL);
+            shmctl(pShmemBuffer->shmem_id, IPC_RMID, NULL);
+            unlockShmemId(id_lock);
+        }
+        free(pShmemBuffer);
+        *phShmem = NULL;
+        return SHMEM_COMM_FAIL;
+    }
+    shmemApplyLayout(pShmemBuffer, pSharedmem, &layout);
 
-    pShmemBuffer->extra_size = NULL;
-    pShmemBuffer->extra_buf  = NULL;
+    pShmemBuffer->reader_id = -1;
+    pShmemBuffer->cursor    = 0;
+    pShmemBuffer->refs      = 1;
 
-    if (shmctl(pShmemBuffer->shmem_id, IPC_STAT, &shm_stat) != -1)
+    if (nOpenMode == MODE_CREATE && pShmemBuffer->ext != NULL)
     {
-#ifdef SHMEM_COMM_DEBUG
-        DEBUG_PRINT("shm_stat.shm_nattch=%d\n", (int)shm_stat.shm_nattch);
-        if (shm_stat.shm_nattch == 1)
-            DEBUG_PRINT("we are the first client\n");
-
-        DEBUG_PRINT("shared memory size = %d\n", shm_stat.shm_segsz);
-#endif
-        // shared momory size larger than total, we use extra data
-        if (shm_stat.shm_segsz > extra_size_offset)
+        memset(pShmemBuffer->ext, 0, sizeof(SHMEM_EXT_T));
+        pShmemBuffer->ext->unit_num = unitNum;
+        // WriteShmem always wakes readers blocked in WaitShmem
+        pShmemBuffer->ext->flags    = SHMEM_EXT_FLAG_WRITER_WAKES;
+        pShmemBuffer->ext->id_hash  = idHash;
+        __atomic_store_n(&pShmemBuffer->ext->magic, SHMEM_EXT_MAGIC, __ATOMIC_RELEASE);
+    }
+    else if (pShmemBuffer->ext != NULL)
+    {
+        if (__atomic_load_n(&pShmemBuffer->ext->magic, __ATOMIC_ACQUIRE) != SHMEM_EXT_MAGIC
+            || pShmemBuffer->ext->unit_num != *pShmemBuffer->unit_num)
+        {
+            pShmemBuffer->ext = NULL;
+        }
+        else if (idHash != 0 && pShmemBuffer->ext->id_hash != idHash)
         {
-            pShmemBuffer->extra_size = (int *)(pSharedmem + extra_size_offset);
-            pShmemBuffer->extra_buf  = pSharedmem + extra_buf_offset;
+            // another id's segment; leave it untouched
+            pShmemBuffer->ext = NULL;
         }
         else
         {
-            pShmemBuffer->extra_size = NULL;
-            pShmemBuffer->extra_buf  = NULL;
+            // start from the frame currently on display, if any
+            unsigned long long last_seq =
+                __atomic_load_n(&pShmemBuffer->ext->last_seq, __ATOMIC_ACQUIRE);
+            pShmemBuffer->cursor    = last_seq ? last_seq : 1;
+            pShmemBuffer->reader_id = shmemRegisterReader(pShmemBuffer->ext,
+                                                          pShmemBuffer->cursor);
+            if (pShmemBuffer->reader_id < 0)
+                DEBUG_PRINT("reader table is full, cursor is kept process local\n");
         }
     }
+    // other creators of the id can now tell the segment is taken
+    unlockShmemId(id_lock);
 
-    if (nOpenMode == MODE_CREATE && pShmemBuffer->extra_size != NULL)
+    if (nOpenMode == MODE_OPEN && idHash != 0 && pShmemBuffer->ext == NULL)
     {
-        *pShmemBuffer->extra_size = extraSize;
+        DEBUG_PRINT("key %d does not belong to id %s\n", shmemKey, id);
+        shmdt(pSharedmem);
+        free(pShmemBuffer);
+        *phShmem = NULL;
+        return SHMEM_COMM_FAIL;
     }
 
-    *pShmemBuffer->mark = SHMEM_COMM_MARK_NORMAL;
     //Until the writter starts to write both write index and read index are
     //set to -1 . So the reader can get to know that the writter has not
-    //started to write yet
-    *pShmemBuffer->write_index = -1;
-    *pShmemBuffer->read_index  = -1;
-
-    resetShmem(pShmemBuffer);
+    //started to write yet. Readers joining a live ring must leave them alone.
+    if (nOpenMode == MODE_CREATE)
+    {
+        *pShmemBuffer->mark = SHMEM_COMM_MARK_NORMAL;
+        *pShmemBuffer->write_index = -1;
+        *pShmemBuffer->read_index  = -1;
+        resetShmem(pShmemBuffer);
+    }
+    pShmemBuffer->last_write_index = -1;
+    pShmemBuffer->last_read_index  = -1;
+    pShmemBuffer->wake_requested   = 0;
 
     DEBUG_PRINT("unitSize = %d, SHMEM_LENGTH_SIZE = %d, unit_num = %d\n", *pShmemBuffer->unit_size,
                 SHMEM_LENGTH_SIZE, *pShmemBuffer->unit_num);
@@ -498,19 +812,19 @@ SHMEM_STATUS_T _ReadShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, int *pSiz
                 return SHMEM_COMM_SIZE;
             }
 
-            read_addr = shmem_buffer->data_buf + (lread_index) * (*shmem_buffer->unit_size);
+            read_addr = shmem_buffer->data_buf + (lread_index) * shmem_buffer->unit_stride;
             *ppData   = read_addr;
             *pSize    = size;
 
             size       = *(int *)(shmem_buffer->length_meta + lread_index);
-            read_addr  = shmem_buffer->data_meta + (lread_index) * (*shmem_buffer->meta_size);
+            read_addr  = shmem_buffer->data_meta + (lread_index) * shmem_buffer->meta_stride;
             *ppMeta    = read_addr;
             *pMetaSize = size;
 
             if (NULL != ppExtraData && NULL != pExtraSize)
             {
                 *ppExtraData = shmem_buffer->extra_buf
-                        + (lread_index) * (*shmem_buffer->extra_size);
+                        + (lread_index) * shmem_buffer->extra_stride;
                 *pExtraSize = *shmem_buffer->extra_size;
             }
         }
@@ -521,6 +835,60 @@ SHMEM_STATUS_T _ReadShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, int *pSiz
     return SHMEM_COMM_OK;
 }
 
+SHMEM_STATUS_T ReadShmemFrame(SHMEM_HANDLE hShmem, SHMEM_READ_MODE_T readMode,
+                              unsigned long long seq, SHMEM_FRAME_T *pFrame)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pFrame)
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    return shmemReadFrame(shmem_buffer, readMode, seq, pFrame);
+}
+
+SHMEM_STATUS_T ReadShmemBatch(SHMEM_HANDLE hShmem, int maxFrames, SHMEM_FRAME_T *pFrames,
+                              int *pCount)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || maxFrames <= 0 || !pFrames || !pCount)
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    return shmemReadBatch(shmem_buffer, maxFrames, pFrames, pCount);
+}
+
+SHMEM_STATUS_T ValidateShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pFrame)
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    return shmemValidateFrame(shmem_buffer, pFrame);
+}
+
+SHMEM_STATUS_T PinShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pFrame)
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    return shmemPinFrame(shmem_buffer, pFrame, detachShmem);
+}
+
 SHMEM_STATUS_T WriteShmemEx(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSize,
                             unsigned char *pMeta, int metaSize, unsigned char *pExtraData,
                             int extraDataSize)
@@ -585,6 +953,14 @@ SHMEM_STATUS_T _WriteShmem(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSi
         return SHMEM_COMM_FAIL;
     }
 
+    if (shmem_buffer->ext != NULL)
+    {
+        SHMEM_STATUS_T ret = shmemWriteFrame(shmem_buffer, pData, dataSize, pMeta, metaSize,
+                                             pExtraData, extraDataSize);
+        unlockShmem(shmem_buffer);
+        return ret;
+    }
+
     //Once the writer writes the last buffer, it is made to point to the first
     //buffer again
     if (lwrite_index == (unit_num - 1))
@@ -593,6 +969,7 @@ SHMEM_STATUS_T _WriteShmem(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSi
                     lread_index, lwrite_index, *shmem_buffer->unit_num);
         //*shmem_buffer->mark = (*shmem_buffer->mark) | SHMEM_COMM_MARK_RESET;
         *shmem_buffer->write_index = 0;
+        shmemFutexWake(shmem_buffer->write_index);
 
         resetShmem(shmem_buffer);
         unlockShmem(shmem_buffer);
@@ -600,24 +977,26 @@ SHMEM_STATUS_T _WriteShmem(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSi
     }
 
     *(int *) (shmem_buffer->length_buf + lwrite_index) = dataSize;
-    memcpy(shmem_buffer->data_buf + lwrite_index * (*shmem_buffer->unit_size), pData, dataSize);
+    memcpy(shmem_buffer->data_buf + lwrite_index * shmem_buffer->unit_stride, pData, dataSize);
 
     if (metaSize < meta_size)
     {
         *(int *)(shmem_buffer->length_meta + lwrite_index) = metaSize;
-        memcpy(shmem_buffer->data_meta + lwrite_index * (*shmem_buffer->meta_size), pMeta,
+        memcpy(shmem_buffer->data_meta + lwrite_index * shmem_buffer->meta_stride, pMeta,
                metaSize);
     }
 
     if (NULL != pExtraData && extraDataSize > 0)
     {
-        memcpy(shmem_buffer->extra_buf + lwrite_index * (*shmem_buffer->extra_size), pExtraData,
+        memcpy(shmem_buffer->extra_buf + lwrite_index * shmem_buffer->extra_stride, pExtraData,
                 extraDataSize);
     }
 
-    *shmem_buffer->write_index += 1;
-    if (*shmem_buffer->write_index == *shmem_buffer->unit_num)
-        *shmem_buffer->write_index = 0;
+    lwrite_index += 1;
+    if (lwrite_index == unit_num)
+        lwrite_index = 0;
+    __atomic_store_n(shmem_buffer->write_index, lwrite_index, __ATOMIC_RELEASE);
+    shmemFutexWake(shmem_buffer->write_index);
 
     unlockShmem(shmem_buffer);
 
@@ -628,21 +1007,104 @@ SHMEM_STATUS_T _WriteShmem(SHMEM_HANDLE hShmem, unsigned char *pData, int dataSi
     return SHMEM_COMM_OK;
 }
 
-SHMEM_STATUS_T CloseShmem(SHMEM_HANDLE *phShmem)
+SHMEM_STATUS_T SetShmemOverflowPolicy(SHMEM_HANDLE hShmem, SHMEM_OVERFLOW_POLICY_T policy,
+                                      int timeoutMs)
 {
-    void *shmem_addr;
-    struct shmid_ds shm_stat;
-    SHMEM_COMM_T *shmem_buffer;
-    DEBUG_PRINT("start");
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
 
-    shmem_buffer = (SHMEM_COMM_T *) *phShmem;
+    if (!shmem_buffer || shmem_buffer->ext == NULL)
+    {
+        DEBUG_PRINT("overflow policy needs a ring with the EXT trailer\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    shmem_buffer->ext->block_timeout_ms = timeoutMs;
+    __atomic_store_n(&shmem_buffer->ext->overflow_policy, policy, __ATOMIC_RELEASE);
+    return SHMEM_COMM_OK;
+}
+
+SHMEM_STATUS_T SetShmemReaderMode(SHMEM_HANDLE hShmem, SHMEM_READER_MODE_T mode)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
 
     if (!shmem_buffer)
     {
-        DEBUG_PRINT("shmem_bufer is NULL\n");
+        DEBUG_PRINT("shmem_buffer is NULL\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    return shmemSetReaderMode(shmem_buffer, mode);
+}
+
+SHMEM_STATUS_T GetShmemStats(SHMEM_HANDLE hShmem, SHMEM_STATS_T *pStats)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || !pStats)
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    return shmemGetStats(shmem_buffer, pStats);
+}
+
+SHMEM_STATUS_T WaitShmem(SHMEM_HANDLE hShmem, int timeoutMs)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer)
+    {
+        DEBUG_PRINT("shmem_buffer is NULL\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    bool writer_wakes = shmem_buffer->ext != NULL
+                        && (shmem_buffer->ext->flags & SHMEM_EXT_FLAG_WRITER_WAKES);
+    if (shmemWaitWriteIndex(shmem_buffer->write_index, &shmem_buffer->last_write_index,
+                            timeoutMs, writer_wakes, &shmem_buffer->wake_requested) != 0)
+    {
+        return SHMEM_COMM_NODATA;
+    }
+
+    return SHMEM_COMM_OK;
+}
+
+SHMEM_STATUS_T WakeShmem(SHMEM_HANDLE hShmem)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer)
+    {
+        DEBUG_PRINT("shmem_buffer is NULL\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    shmemWakeWaiters(shmem_buffer->write_index, &shmem_buffer->wake_requested);
+    return SHMEM_COMM_OK;
+}
+
+SHMEM_STATUS_T GetShmemWriterWakes(SHMEM_HANDLE hShmem)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || shmem_buffer->ext == NULL
+        || !(shmem_buffer->ext->flags & SHMEM_EXT_FLAG_WRITER_WAKES))
+    {
         return SHMEM_COMM_FAIL;
     }
 
+    return SHMEM_COMM_OK;
+}
+
+static void detachShmem(SHMEM_COMM_T *shmem_buffer)
+{
+    void *shmem_addr;
+    struct shmid_ds shm_stat;
+
+    if (shmem_buffer->ext != NULL)
+        shmemUnregisterReader(shmem_buffer->ext, shmem_buffer->reader_id);
+
     shmem_addr = shmem_buffer->write_index;
     shmdt(shmem_addr);
 
@@ -662,7 +1124,42 @@ SHMEM_STATUS_T CloseShmem(SHMEM_HANDLE *phShmem)
     }
 
     free(shmem_buffer);
-    shmem_buffer = NULL;
+}
+
+SHMEM_STATUS_T UnpinShmemFrame(SHMEM_HANDLE hShmem, int slot)
+{
+    SHMEM_COMM_T *shmem_buffer = (SHMEM_COMM_T *) hShmem;
+
+    if (!shmem_buffer || shmem_buffer->ext == NULL || shmem_buffer->reader_id < 0
+        || slot < 0 || slot >= *shmem_buffer->unit_num)
+    {
+        DEBUG_PRINT("Invalid argument\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    shmemUnpinSlot(shmem_buffer, slot, detachShmem);
+    return SHMEM_COMM_OK;
+}
+
+SHMEM_STATUS_T CloseShmem(SHMEM_HANDLE *phShmem)
+{
+    SHMEM_COMM_T *shmem_buffer;
+    DEBUG_PRINT("start");
+
+    shmem_buffer = (SHMEM_COMM_T *) *phShmem;
+
+    if (!shmem_buffer)
+    {
+        DEBUG_PRINT("shmem_bufer is NULL\n");
+        return SHMEM_COMM_FAIL;
+    }
+
+    // leased frames may still be in use downstream; the segment is detached
+    // when the last of them is released
+    __atomic_store_n(&shmem_buffer->closing, 1, __ATOMIC_SEQ_CST);
+    shmemUnref(shmem_buffer, detachShmem);
+
+    *phShmem = NULL;
     DEBUG_PRINT("end");
     return SHMEM_COMM_OK;
 }
@@ -16,6 +16,9 @@
 
 #ifndef SRC_HAL_UTILS_CAMSHM_H_
 #define SRC_HAL_UTILS_CAMSHM_H_
+
+#include <sys/types.h>
+
 typedef enum _SHMEM_STATUS_T
 {
     SHMEM_COMM_OK        = 0x0,
@@ -28,11 +31,80 @@ typedef enum _SHMEM_STATUS_T
 
 typedef void * SHMEM_HANDLE;
 
+typedef enum _SHMEM_READ_MODE_T
+{
+    SHMEM_READ_NEXT   = 0x0, // oldest frame this handle has not read yet
+    SHMEM_READ_LATEST = 0x1, // most recently published frame
+    SHMEM_READ_SEQ    = 0x2, // the frame with the given sequence number
+} SHMEM_READ_MODE_T;
+
+// What the producer does when the slot it is about to reuse still holds a
+// frame a lossless reader has not read.
+typedef enum _SHMEM_OVERFLOW_POLICY_T
+{
+    SHMEM_OVERFLOW_DROP_OLDEST = 0x0, // overwrite it (default)
+    SHMEM_OVERFLOW_DROP_NEWEST = 0x1, // drop the incoming frame instead
+    SHMEM_OVERFLOW_BLOCK       = 0x2, // wait for the reader, or drop the incoming frame on timeout
+} SHMEM_OVERFLOW_POLICY_T;
+
+typedef enum _SHMEM_READER_MODE_T
+{
+    SHMEM_READER_LATEST   = 0x0, // may miss frames, never holds the producer back
+    SHMEM_READER_LOSSLESS = 0x1, // protected by the producer's overflow policy
+} SHMEM_READER_MODE_T;
+
+// Layout flags for CreateShmemByIdEx() and CreatePosixShmemEx(). Aligned
+// rings can only be read by readers built with this version of the library.
+typedef enum _SHMEM_LAYOUT_FLAGS_T
+{
+    SHMEM_LAYOUT_PACKED        = 0x0, // slots back to back (default)
+    SHMEM_LAYOUT_CACHE_ALIGNED = 0x1, // slots, meta and extra blocks start on 64 byte boundaries
+    SHMEM_LAYOUT_PAGE_ALIGNED  = 0x2, // ... on page boundaries
+    SHMEM_LAYOUT_HUGETLB       = 0x4, // back with huge pages, falls back to normal pages
+} SHMEM_LAYOUT_FLAGS_T;
+
+typedef struct _SHMEM_STATS_T
+{
+    unsigned long long written;     // frames published
+    unsigned long long dropped;     // incoming frames discarded by the producer
+    unsigned long long overwritten; // frames overwritten before a lossless reader got them
+    unsigned long long blocked;     // writes that waited for a lossless reader
+    unsigned long long timeouts;    // waits that expired
+    unsigned long long last_seq;    // sequence number of the latest published frame, 0 if none
+} SHMEM_STATS_T;
+
+typedef struct _SHMEM_FRAME_T
+{
+    unsigned char *pData;
+    int size;
+    unsigned char *pMeta;
+    int metaSize;
+    unsigned char *pExtraData;
+    int extraSize;
+    unsigned long long seq;     // 0 if the producer does not number frames
+    unsigned long long dropped; // frames skipped since the previous read
+    int slot;                   // ring slot holding the frame
+    unsigned int gen;           // slot generation when the frame was read
+} SHMEM_FRAME_T;
+
 extern SHMEM_STATUS_T CreateShmem(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize,
                                   int metaSize, int unitNum);
 extern SHMEM_STATUS_T CreateShmemEx(SHMEM_HANDLE *phShmem, key_t *pShmemKey, int unitSize,
                                     int metaSize, int unitNum, int extraSize);
 extern SHMEM_STATUS_T OpenShmem(SHMEM_HANDLE *phShmem, key_t shmemKey);
+
+// Create/open a segment whose key is derived from id (e.g. the camera id),
+// so producer and readers agree on it without scanning the key space. The
+// key actually used is returned in pShmemKey and can be passed to
+// OpenShmem() as before. Rings with more than 64 units have no room for the
+// id and must be opened by key.
+extern SHMEM_STATUS_T CreateShmemById(SHMEM_HANDLE *phShmem, const char *id, key_t *pShmemKey,
+                                      int unitSize, int metaSize, int unitNum, int extraSize);
+// layoutFlags is a mask of SHMEM_LAYOUT_FLAGS_T.
+extern SHMEM_STATUS_T CreateShmemByIdEx(SHMEM_HANDLE *phShmem, const char *id, key_t *pShmemKey,
+                                        int unitSize, int metaSize, int unitNum, int extraSize,
+                                        unsigned int layoutFlags);
+extern SHMEM_STATUS_T OpenShmemById(SHMEM_HANDLE *phShmem, const char *id, key_t *pShmemKey);
 extern SHMEM_STATUS_T ReadShmem(SHMEM_HANDLE hShmem, unsigned char **ppData, int *pSize,
                                 unsigned char **ppMeta, int *pMetaSize);
 extern SHMEM_STATUS_T ReadShmemEx(SHMEM_HANDLE hShmem, unsigned char **ppData, int *pSize,
@@ -50,4 +122,51 @@ extern SHMEM_STATUS_T WriteShmemEx(SHMEM_HANDLE hShmem, unsigned char *pData, in
                                    int extraDataSize);
 extern SHMEM_STATUS_T CloseShmem(SHMEM_HANDLE *phShmem);
 
+// Blocks until the producer publishes a frame this handle has not waited for
+// yet. timeoutMs < 0 waits forever. Returns SHMEM_COMM_NODATA on timeout.
+extern SHMEM_STATUS_T WaitShmem(SHMEM_HANDLE hShmem, int timeoutMs);
+
+// Makes a WaitShmem on this handle in another thread return SHMEM_COMM_NODATA,
+// or the next one if none is waiting yet.
+extern SHMEM_STATUS_T WakeShmem(SHMEM_HANDLE hShmem);
+
+// Returns SHMEM_COMM_OK if the producer wakes WaitShmem() when it publishes
+// a frame, SHMEM_COMM_FAIL if waiting on this ring falls back to polling.
+extern SHMEM_STATUS_T GetShmemWriterWakes(SHMEM_HANDLE hShmem);
+
+// Reads a frame without copying it. SHMEM_READ_NEXT and SHMEM_READ_LATEST
+// advance the per-reader cursor and report how many frames were skipped.
+// Returns SHMEM_COMM_NODATA if there is nothing new, and SHMEM_COMM_OVERFLOW
+// if the SHMEM_READ_SEQ frame has already been overwritten.
+extern SHMEM_STATUS_T ReadShmemFrame(SHMEM_HANDLE hShmem, SHMEM_READ_MODE_T readMode,
+                                     unsigned long long seq, SHMEM_FRAME_T *pFrame);
+
+// Drains up to maxFrames consecutive unread frames in one call, oldest first,
+// as ReadShmemFrame(SHMEM_READ_NEXT) would return them one at a time. The
+// number of frames filled in is returned in pCount. Rings without sequence
+// numbers return at most one frame.
+extern SHMEM_STATUS_T ReadShmemBatch(SHMEM_HANDLE hShmem, int maxFrames, SHMEM_FRAME_T *pFrames,
+                                     int *pCount);
+
+// Returns SHMEM_COMM_OK if the frame read by ReadShmemFrame() has not been
+// overwritten since, SHMEM_COMM_OVERFLOW if it has. Frames without a
+// sequence number cannot be checked and are reported as intact.
+extern SHMEM_STATUS_T ValidateShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame);
+
+// Leases the frame's slot so the producer does not reuse it until
+// UnpinShmemFrame() is called. Fails if the producer does not support
+// leases or this handle already holds too many; copy the frame instead.
+// CloseShmem() keeps the segment attached until every lease is released;
+// a handle that is being closed takes no new leases (SHMEM_COMM_TERMINATE).
+extern SHMEM_STATUS_T PinShmemFrame(SHMEM_HANDLE hShmem, const SHMEM_FRAME_T *pFrame);
+extern SHMEM_STATUS_T UnpinShmemFrame(SHMEM_HANDLE hShmem, int slot);
+
+// Producer side. timeoutMs only applies to SHMEM_OVERFLOW_BLOCK, < 0 waits
+// forever. Fails on rings without the EXT trailer, which always overwrite.
+extern SHMEM_STATUS_T SetShmemOverflowPolicy(SHMEM_HANDLE hShmem, SHMEM_OVERFLOW_POLICY_T policy,
+                                             int timeoutMs);
+// Reader side. Readers start as SHMEM_READER_LATEST.
+extern SHMEM_STATUS_T SetShmemReaderMode(SHMEM_HANDLE hShmem, SHMEM_READER_MODE_T mode);
+extern SHMEM_STATUS_T GetShmemStats(SHMEM_HANDLE hShmem, SHMEM_STATS_T *pStats);
+
 #endif //SRC_HAL_UTILS_CAMSHM_H_
@@ -0,0 +1,915 @@
+// Copyright (c) 2023 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+// Helpers shared by the SysV (camshm.cpp) and POSIX (cam_posixshm.cpp) ring
+// buffer implementations. Not part of the public API.
+
+#ifndef SRC_HAL_UTILS_CAMSHM_INTERNAL_H_
+#define SRC_HAL_UTILS_CAMSHM_INTERNAL_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "camshm.h"
+
+#define SHMEM_ALIGN(x, a) (((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+
+// Optional trailer placed after the extra data. Segments created by older
+// producers do not have it, and readers fall back to index based reads.
+#define SHMEM_EXT_MAGIC   0x43534d58
+#define SHMEM_MAX_UNITS   64
+#define SHMEM_MAX_READERS 8
+
+// SHMEM_EXT_T flags
+#define SHMEM_EXT_FLAG_WRITER_WAKES 0x1 // the writer issues FUTEX_WAKE on write_index
+
+typedef struct _SHMEM_READER_T
+{
+    int pid;                    // owner process, 0 when the entry is free
+    int lossless;               // SHMEM_READER_LOSSLESS
+    unsigned long long cursor;  // next sequence number the reader wants
+    unsigned long long dropped; // frames the reader never got to see
+    unsigned short pin[SHMEM_MAX_UNITS]; // leases the reader holds on each slot
+} SHMEM_READER_T;
+
+typedef struct _SHMEM_EXT_T
+{
+    int magic;
+    int unit_num;
+    unsigned int id_hash;                       // hash of the id passed to CreateShmemById
+    unsigned int flags;                         // SHMEM_EXT_FLAG_*
+    unsigned long long last_seq;                // latest published frame, 0 if none
+    int overflow_policy;                        // SHMEM_OVERFLOW_POLICY_T
+    int block_timeout_ms;
+    int reader_advance;                         // futex, bumped whenever a reader moves on
+    int writer_waiting;
+    SHMEM_STATS_T stats;
+    unsigned long long seq[SHMEM_MAX_UNITS];    // frame held by each slot, 0 if none
+    unsigned int gen[SHMEM_MAX_UNITS];          // seqlock, odd while the slot is written
+    SHMEM_READER_T reader[SHMEM_MAX_READERS];
+} SHMEM_EXT_T;
+
+// Descriptor stored right after the header of rings created with
+// SHMEM_LAYOUT_CACHE_ALIGNED or SHMEM_LAYOUT_PAGE_ALIGNED. In packed rings
+// the same bytes hold length_buf[0], which never reaches the magic value.
+#define SHMEM_LAYOUT_MAGIC   0x43534d4c
+#define SHMEM_HEADER_BYTES   (6 * sizeof(int))
+#define SHMEM_CACHELINE_SIZE 64
+#define SHMEM_HUGEPAGE_SIZE  (2 * 1024 * 1024) // if /proc/meminfo does not say
+
+typedef struct _SHMEM_LAYOUT_T
+{
+    unsigned int magic;
+    unsigned int align;        // 1 for the packed layout
+    unsigned int unit_stride;  // distance between two slots
+    unsigned int meta_stride;
+    unsigned int extra_stride;
+    // byte offsets from the start of the segment, 0 if absent
+    unsigned int length_buf;
+    unsigned int data_buf;
+    unsigned int length_meta;
+    unsigned int data_meta;
+    unsigned int extra_size;
+    unsigned int extra_buf;
+    unsigned int ext;
+    unsigned int size;         // bytes in use, before any hugepage rounding
+} SHMEM_LAYOUT_T;
+
+// Lays out a new ring. The packed layout is the one every reader
+// understands; the aligned ones keep the length arrays together after the
+// header and start each slot, meta block and extra block on an align
+// boundary so frame copies never split a cache line.
+static inline int shmemMakeLayout(SHMEM_LAYOUT_T *l, int unitSize, int metaSize, int unitNum,
+                                  int extraSize, unsigned int flags)
+{
+    size_t a = 1, off;
+
+    if (flags & SHMEM_LAYOUT_PAGE_ALIGNED)
+        a = sysconf(_SC_PAGESIZE);
+    else if (flags & SHMEM_LAYOUT_CACHE_ALIGNED)
+        a = SHMEM_CACHELINE_SIZE;
+
+    memset(l, 0, sizeof(*l));
+    l->align        = a;
+    l->unit_stride  = SHMEM_ALIGN((size_t)unitSize, a);
+    l->meta_stride  = SHMEM_ALIGN((size_t)metaSize, a);
+    l->extra_stride = SHMEM_ALIGN((size_t)extraSize, a);
+
+    if (a == 1)
+    {
+        l->length_buf  = SHMEM_HEADER_BYTES;
+        l->data_buf    = l->length_buf + sizeof(int) * unitNum;
+        l->length_meta = l->data_buf + (size_t)unitSize * unitNum;
+        l->data_meta   = l->length_meta + sizeof(int) * unitNum;
+        l->extra_size  = l->data_meta + (size_t)metaSize * unitNum;
+        l->extra_buf   = l->extra_size + sizeof(int);
+        off = l->extra_buf + (size_t)extraSize * unitNum;
+        a   = 8;
+    }
+    else
+    {
+        l->magic       = SHMEM_LAYOUT_MAGIC;
+        l->length_buf  = SHMEM_HEADER_BYTES + sizeof(SHMEM_LAYOUT_T);
+        l->length_meta = l->length_buf + sizeof(int) * unitNum;
+        l->extra_size  = l->length_meta + sizeof(int) * unitNum;
+        l->data_buf    = SHMEM_ALIGN(l->extra_size + sizeof(int), a);
+        l->data_meta   = l->data_buf + (size_t)l->unit_stride * unitNum;
+        l->extra_buf   = l->data_meta + (size_t)l->meta_stride * unitNum;
+        off = l->extra_buf + (size_t)l->extra_stride * unitNum;
+    }
+
+    if (unitNum <= SHMEM_MAX_UNITS)
+    {
+        l->ext = SHMEM_ALIGN(off, a);
+        off    = l->ext + sizeof(SHMEM_EXT_T);
+    }
+    if (off > UINT_MAX)
+        return -1;
+    l->size = off;
+    return 0;
+}
+
+// Recovers the layout of an existing ring from its header. Packed rings are
+// sized by the creator, so the extra data and EXT trailer are only assumed
+// present if the segment is large enough to hold them.
+static inline int shmemReadLayout(SHMEM_LAYOUT_T *l, const unsigned char *base, size_t size)
+{
+    const int *header = (const int *) base;
+    int unit_size = header[2], meta_size = header[3], unit_num = header[4];
+    int extra_size;
+
+    if (size < SHMEM_HEADER_BYTES || unit_size <= 0 || meta_size < 0 || unit_num <= 0)
+        return -1;
+
+    if (size >= SHMEM_HEADER_BYTES + sizeof(SHMEM_LAYOUT_T)
+        && *(const unsigned int *)(base + SHMEM_HEADER_BYTES) == SHMEM_LAYOUT_MAGIC)
+    {
+        memcpy(l, base + SHMEM_HEADER_BYTES, sizeof(*l));
+        if (l->unit_stride < (unsigned int)unit_size || l->meta_stride < (unsigned int)meta_size
+            || l->size > size || l->data_buf + (size_t)l->unit_stride * unit_num > l->size
+            || l->data_meta + (size_t)l->meta_stride * unit_num > l->size
+            || l->extra_buf + (size_t)l->extra_stride * unit_num > l->size
+            || (l->ext != 0 && l->ext + sizeof(SHMEM_EXT_T) > l->size))
+            return -1;
+        return 0;
+    }
+
+    if (shmemMakeLayout(l, unit_size, meta_size, unit_num, 0, 0) != 0 || size < l->extra_size)
+        return -1;
+    l->ext = 0;
+    if (size < l->extra_buf)
+    {
+        l->extra_size = 0;
+        l->extra_buf  = 0;
+        return 0;
+    }
+
+    extra_size = *(const int *)(base + l->extra_size);
+    if (extra_size < 0 || l->extra_buf + (size_t)extra_size * unit_num > size)
+    {
+        l->extra_size = 0;
+        l->extra_buf  = 0;
+        return 0;
+    }
+    l->extra_stride = extra_size;
+
+    size_t ext = SHMEM_ALIGN(l->extra_buf + (size_t)extra_size * unit_num, 8);
+    if (size >= ext + sizeof(SHMEM_EXT_T))
+        l->ext = ext;
+    return 0;
+}
+
+// Points the handle at the parts of the ring described by l.
+template <typename COMM_T>
+static void shmemApplyLayout(COMM_T *comm, unsigned char *base, const SHMEM_LAYOUT_T *l)
+{
+    comm->length_buf   = (unsigned int *)(base + l->length_buf);
+    comm->data_buf     = base + l->data_buf;
+    comm->length_meta  = (unsigned int *)(base + l->length_meta);
+    comm->data_meta    = base + l->data_meta;
+    comm->extra_size   = l->extra_size ? (int *)(base + l->extra_size) : NULL;
+    comm->extra_buf    = l->extra_size ? base + l->extra_buf : NULL;
+    comm->ext          = l->ext ? (SHMEM_EXT_T *)(base + l->ext) : NULL;
+    comm->unit_stride  = l->unit_stride;
+    comm->meta_stride  = l->meta_stride;
+    comm->extra_stride = l->extra_stride;
+}
+
+static inline size_t shmemHugePageSize(void)
+{
+    size_t size = SHMEM_HUGEPAGE_SIZE;
+    unsigned long kb;
+    char line[128];
+    FILE *fp = fopen("/proc/meminfo", "r");
+
+    if (fp == NULL)
+        return size;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+        {
+            size = kb * 1024;
+            break;
+        }
+    }
+    fclose(fp);
+    return size;
+}
+
+// Interval at which a writer blocked on a full ring re-checks the readers.
+#define SHMEM_WAIT_SLICE_MS 2
+
+// A producer that does not set SHMEM_EXT_FLAG_WRITER_WAKES (e.g. an older HAL
+// build) never issues FUTEX_WAKE, so readers can only poll write_index. The
+// interval trades a little frame latency for far fewer idle wakeups.
+#define SHMEM_POLL_SLICE_MS 10
+
+// timeoutMs < 0 sleeps until woken
+static inline int shmemFutexWait(int *addr, int expected, int timeoutMs)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    return syscall(SYS_futex, addr, FUTEX_WAIT, expected, timeoutMs < 0 ? NULL : &ts, NULL, 0);
+}
+
+static inline void shmemFutexWake(int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline long shmemElapsedMs(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+// Waits until *pWriteIndex is published and differs from *pLastSeen.
+// timeoutMs < 0 waits forever. Returns 0 on a new frame, -1 on timeout or
+// once *pWakeRequested is set by shmemWakeWaiters().
+// Only a writer that wakes readers lets them sleep through idle periods.
+static inline int shmemWaitWriteIndex(int *pWriteIndex, int *pLastSeen, int timeoutMs,
+                                      bool writerWakes, int *pWakeRequested)
+{
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1)
+    {
+        int current = __atomic_load_n(pWriteIndex, __ATOMIC_ACQUIRE);
+        int slice   = writerWakes ? -1 : SHMEM_POLL_SLICE_MS;
+
+        if (__atomic_exchange_n(pWakeRequested, 0, __ATOMIC_ACQ_REL))
+            return -1;
+
+        if (current != -1 && current != *pLastSeen)
+        {
+            *pLastSeen = current;
+            return 0;
+        }
+
+        if (timeoutMs >= 0)
+        {
+            long remaining = timeoutMs - shmemElapsedMs(&start);
+            if (remaining <= 0)
+                return -1;
+            if (slice < 0 || remaining < slice)
+                slice = (int)remaining;
+        }
+
+        shmemFutexWait(pWriteIndex, current, slice);
+    }
+}
+
+// Interrupts shmemWaitWriteIndex() on the same handle. A waiter that is
+// just about to sleep can miss the wakeup, so callers that need the waiter
+// gone repeat this until it has returned.
+static inline void shmemWakeWaiters(int *pWriteIndex, int *pWakeRequested)
+{
+    __atomic_store_n(pWakeRequested, 1, __ATOMIC_RELEASE);
+    shmemFutexWake(pWriteIndex);
+}
+
+static inline int shmemFindSlot(SHMEM_EXT_T *ext, int unitNum, unsigned long long seq)
+{
+    for (int i = 0; i < unitNum; i++)
+    {
+        if (__atomic_load_n(&ext->seq[i], __ATOMIC_ACQUIRE) == seq)
+            return i;
+    }
+    return -1;
+}
+
+// Returns the oldest frame still in the ring that is not older than seq,
+// or 0 if there is none.
+static inline unsigned long long shmemOldestSeqFrom(SHMEM_EXT_T *ext, int unitNum,
+                                                    unsigned long long seq)
+{
+    unsigned long long oldest = 0;
+
+    for (int i = 0; i < unitNum; i++)
+    {
+        unsigned long long slot_seq = __atomic_load_n(&ext->seq[i], __ATOMIC_ACQUIRE);
+        if (slot_seq >= seq && (oldest == 0 || slot_seq < oldest))
+            oldest = slot_seq;
+    }
+    return oldest;
+}
+
+// Claims a free reader entry, reusing entries left behind by dead processes.
+// Returns the entry index or -1 if the table is full.
+static inline int shmemRegisterReader(SHMEM_EXT_T *ext, unsigned long long cursor)
+{
+    int pid = getpid();
+
+    for (int i = 0; i < SHMEM_MAX_READERS; i++)
+    {
+        int owner = __atomic_load_n(&ext->reader[i].pid, __ATOMIC_ACQUIRE);
+        if (owner != 0 && !(kill(owner, 0) == -1 && errno == ESRCH))
+            continue;
+        if (__atomic_compare_exchange_n(&ext->reader[i].pid, &owner, pid, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            for (int j = 0; j < SHMEM_MAX_UNITS; j++)
+                __atomic_store_n(&ext->reader[i].pin[j], 0, __ATOMIC_RELAXED);
+            ext->reader[i].dropped = 0;
+            __atomic_store_n(&ext->reader[i].lossless, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&ext->reader[i].cursor, cursor, __ATOMIC_RELEASE);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Lets a writer blocked on this reader re-check the ring.
+static inline void shmemReaderAdvanced(SHMEM_EXT_T *ext)
+{
+    __atomic_add_fetch(&ext->reader_advance, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ext->writer_waiting, __ATOMIC_SEQ_CST))
+        shmemFutexWake(&ext->reader_advance);
+}
+
+static inline void shmemUnregisterReader(SHMEM_EXT_T *ext, int readerId)
+{
+    if (readerId < 0 || readerId >= SHMEM_MAX_READERS)
+        return;
+    __atomic_store_n(&ext->reader[readerId].lossless, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&ext->reader[readerId].cursor, 0ULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&ext->reader[readerId].pid, 0, __ATOMIC_RELEASE);
+    shmemReaderAdvanced(ext);
+}
+
+// Leases held by readers that died without releasing them are ignored.
+static inline bool shmemSlotPinned(SHMEM_EXT_T *ext, int slot)
+{
+    for (int i = 0; i < SHMEM_MAX_READERS; i++)
+    {
+        int owner = __atomic_load_n(&ext->reader[i].pid, __ATOMIC_SEQ_CST);
+        if (owner == 0 || __atomic_load_n(&ext->reader[i].pin[slot], __ATOMIC_SEQ_CST) == 0)
+            continue;
+        if (kill(owner, 0) == -1 && errno == ESRCH)
+            continue;
+        return true;
+    }
+    return false;
+}
+
+// Writer side of the slot seqlock. Marks the slot as being written and
+// returns false, leaving the slot untouched, if a reader holds a lease on it.
+static inline bool shmemBeginSlotWrite(SHMEM_EXT_T *ext, int slot)
+{
+    unsigned int gen       = ext->gen[slot];
+    unsigned long long seq = ext->seq[slot];
+
+    __atomic_store_n(&ext->seq[slot], 0ULL, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ext->gen[slot], gen + 1, __ATOMIC_SEQ_CST);
+    if (!shmemSlotPinned(ext, slot))
+        return true;
+
+    __atomic_store_n(&ext->gen[slot], gen, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ext->seq[slot], seq, __ATOMIC_SEQ_CST);
+    return false;
+}
+
+static inline void shmemEndSlotWrite(SHMEM_EXT_T *ext, int slot)
+{
+    unsigned long long seq = ext->last_seq + 1;
+
+    __atomic_store_n(&ext->gen[slot], ext->gen[slot] + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ext->seq[slot], seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ext->last_seq, seq, __ATOMIC_RELEASE);
+}
+
+#define SHMEM_STATS_INC(ext, field) __atomic_add_fetch(&(ext)->stats.field, 1, __ATOMIC_RELAXED)
+
+// Whether the slot still holds a frame that a live lossless reader has not
+// read yet. Latest-only readers never hold the writer back.
+static inline bool shmemSlotUnread(SHMEM_EXT_T *ext, int slot)
+{
+    unsigned long long seq = __atomic_load_n(&ext->seq[slot], __ATOMIC_ACQUIRE);
+
+    if (seq == 0)
+        return false;
+
+    for (int i = 0; i < SHMEM_MAX_READERS; i++)
+    {
+        SHMEM_READER_T *reader = &ext->reader[i];
+        int owner = __atomic_load_n(&reader->pid, __ATOMIC_ACQUIRE);
+        unsigned long long cursor;
+
+        if (owner == 0 || !__atomic_load_n(&reader->lossless, __ATOMIC_ACQUIRE))
+            continue;
+        cursor = __atomic_load_n(&reader->cursor, __ATOMIC_ACQUIRE);
+        if (cursor == 0 || cursor > seq)
+            continue;
+        if (kill(owner, 0) == -1 && errno == ESRCH)
+            continue;
+        return true;
+    }
+    return false;
+}
+
+static inline bool shmemWaitSlotConsumed(SHMEM_EXT_T *ext, int slot, int timeoutMs)
+{
+    struct timespec start;
+    bool consumed = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    __atomic_store_n(&ext->writer_waiting, 1, __ATOMIC_SEQ_CST);
+    while (1)
+    {
+        int advance = __atomic_load_n(&ext->reader_advance, __ATOMIC_SEQ_CST);
+        int slice   = SHMEM_WAIT_SLICE_MS;
+
+        if (!shmemSlotUnread(ext, slot))
+        {
+            consumed = true;
+            break;
+        }
+
+        if (timeoutMs >= 0)
+        {
+            long remaining = timeoutMs - shmemElapsedMs(&start);
+            if (remaining <= 0)
+                break;
+            if (remaining < slice)
+                slice = (int)remaining;
+        }
+
+        shmemFutexWait(&ext->reader_advance, advance, slice);
+    }
+    __atomic_store_n(&ext->writer_waiting, 0, __ATOMIC_SEQ_CST);
+    return consumed;
+}
+
+// Picks the slot for the next frame, starting at *pSlot, and marks it as
+// being written. Leased slots are skipped. Returns SHMEM_COMM_OVERFLOW if the
+// overflow policy or the leases say the frame has to be dropped.
+static inline SHMEM_STATUS_T shmemClaimSlot(SHMEM_EXT_T *ext, int unitNum, int *pSlot)
+{
+    int slot = *pSlot;
+
+    for (int attempt = 0; attempt < unitNum; attempt++, slot = (slot + 1) % unitNum)
+    {
+        if (shmemSlotUnread(ext, slot))
+        {
+            switch (ext->overflow_policy)
+            {
+            case SHMEM_OVERFLOW_DROP_NEWEST:
+                SHMEM_STATS_INC(ext, dropped);
+                return SHMEM_COMM_OVERFLOW;
+            case SHMEM_OVERFLOW_BLOCK:
+                SHMEM_STATS_INC(ext, blocked);
+                if (!shmemWaitSlotConsumed(ext, slot, ext->block_timeout_ms))
+                {
+                    SHMEM_STATS_INC(ext, timeouts);
+                    SHMEM_STATS_INC(ext, dropped);
+                    return SHMEM_COMM_OVERFLOW;
+                }
+                break;
+            default:
+                SHMEM_STATS_INC(ext, overwritten);
+                break;
+            }
+        }
+
+        if (shmemBeginSlotWrite(ext, slot))
+        {
+            *pSlot = slot;
+            return SHMEM_COMM_OK;
+        }
+    }
+
+    // every slot is leased
+    SHMEM_STATS_INC(ext, dropped);
+    return SHMEM_COMM_OVERFLOW;
+}
+
+// The functions below are shared by the SysV and POSIX handles, which use
+// the same field names for the ring.
+
+// Unlike the legacy SysV writer this wraps around without dropping a frame.
+// Without the EXT trailer slots are simply overwritten in order.
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemWriteFrame(COMM_T *comm, unsigned char *pData, int dataSize,
+                                      unsigned char *pMeta, int metaSize,
+                                      unsigned char *pExtraData, int extraDataSize)
+{
+    SHMEM_EXT_T *ext = comm->ext;
+    int unit_num     = *comm->unit_num;
+    int slot         = __atomic_load_n(comm->write_index, __ATOMIC_ACQUIRE);
+    SHMEM_STATUS_T ret;
+
+    if (slot < 0 || slot >= unit_num)
+        slot = 0;
+
+    if (ext != NULL)
+    {
+        ret = shmemClaimSlot(ext, unit_num, &slot);
+        if (ret != SHMEM_COMM_OK)
+            return ret;
+    }
+
+    *(int *)(comm->length_buf + slot) = dataSize;
+    memcpy(comm->data_buf + slot * comm->unit_stride, pData, dataSize);
+
+    if (pMeta != NULL && metaSize <= *comm->meta_size)
+    {
+        *(int *)(comm->length_meta + slot) = metaSize;
+        memcpy(comm->data_meta + slot * comm->meta_stride, pMeta, metaSize);
+    }
+    else
+    {
+        *(int *)(comm->length_meta + slot) = 0;
+    }
+
+    if (pExtraData != NULL && extraDataSize > 0 && comm->extra_buf != NULL
+        && extraDataSize <= *comm->extra_size)
+        memcpy(comm->extra_buf + slot * comm->extra_stride, pExtraData, extraDataSize);
+
+    if (ext != NULL)
+    {
+        shmemEndSlotWrite(ext, slot);
+        SHMEM_STATS_INC(ext, written);
+    }
+
+    __atomic_store_n(comm->write_index, (slot + 1 == unit_num) ? 0 : slot + 1, __ATOMIC_RELEASE);
+    shmemFutexWake(comm->write_index);
+    return SHMEM_COMM_OK;
+}
+
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemSetReaderMode(COMM_T *comm, SHMEM_READER_MODE_T mode)
+{
+    if (comm->ext == NULL || comm->reader_id < 0)
+        return SHMEM_COMM_FAIL;
+
+    __atomic_store_n(&comm->ext->reader[comm->reader_id].lossless,
+                     mode == SHMEM_READER_LOSSLESS, __ATOMIC_RELEASE);
+    if (mode != SHMEM_READER_LOSSLESS)
+        shmemReaderAdvanced(comm->ext);
+    return SHMEM_COMM_OK;
+}
+
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemGetStats(COMM_T *comm, SHMEM_STATS_T *pStats)
+{
+    SHMEM_EXT_T *ext = comm->ext;
+
+    if (ext == NULL)
+        return SHMEM_COMM_FAIL;
+
+    pStats->written     = __atomic_load_n(&ext->stats.written, __ATOMIC_RELAXED);
+    pStats->dropped     = __atomic_load_n(&ext->stats.dropped, __ATOMIC_RELAXED);
+    pStats->overwritten = __atomic_load_n(&ext->stats.overwritten, __ATOMIC_RELAXED);
+    pStats->blocked     = __atomic_load_n(&ext->stats.blocked, __ATOMIC_RELAXED);
+    pStats->timeouts    = __atomic_load_n(&ext->stats.timeouts, __ATOMIC_RELAXED);
+    pStats->last_seq    = __atomic_load_n(&ext->last_seq, __ATOMIC_ACQUIRE);
+    return SHMEM_COMM_OK;
+}
+
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemFillFrame(COMM_T *comm, int index, SHMEM_FRAME_T *pFrame)
+{
+    int size = *(int *)(comm->length_buf + index);
+
+    if ((size == 0) || (size > *comm->unit_size))
+        return SHMEM_COMM_SIZE;
+
+    pFrame->pData    = comm->data_buf + index * comm->unit_stride;
+    pFrame->size     = size;
+    pFrame->pMeta    = comm->data_meta + index * comm->meta_stride;
+    pFrame->metaSize = *(int *)(comm->length_meta + index);
+
+    if (comm->extra_size != NULL)
+    {
+        pFrame->pExtraData = comm->extra_buf + index * comm->extra_stride;
+        pFrame->extraSize  = *comm->extra_size;
+    }
+    else
+    {
+        pFrame->pExtraData = NULL;
+        pFrame->extraSize  = 0;
+    }
+    pFrame->slot = index;
+    return SHMEM_COMM_OK;
+}
+
+// Segments without the EXT trailer have no sequence numbers. The write index
+// changing since the previous read stands in for "there is an unread frame".
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemReadFrameLegacy(COMM_T *comm, SHMEM_READ_MODE_T readMode,
+                                           SHMEM_FRAME_T *pFrame)
+{
+    int lwrite_index = __atomic_load_n(comm->write_index, __ATOMIC_ACQUIRE);
+    int lread_index;
+    SHMEM_STATUS_T ret;
+
+    if (readMode == SHMEM_READ_SEQ)
+        return SHMEM_COMM_FAIL;
+
+    if (lwrite_index == -1)
+        return SHMEM_COMM_NODATA;
+
+    if (readMode == SHMEM_READ_NEXT && lwrite_index == comm->last_read_index)
+        return SHMEM_COMM_NODATA;
+
+    lread_index = (lwrite_index == 0) ? *comm->unit_num - 1 : lwrite_index - 1;
+    ret = shmemFillFrame(comm, lread_index, pFrame);
+    if (ret != SHMEM_COMM_OK)
+        return ret;
+
+    comm->last_read_index = lwrite_index;
+    pFrame->seq     = 0;
+    pFrame->gen     = 0;
+    pFrame->dropped = 0;
+    return SHMEM_COMM_OK;
+}
+
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemReadFrame(COMM_T *comm, SHMEM_READ_MODE_T readMode,
+                                     unsigned long long seq, SHMEM_FRAME_T *pFrame)
+{
+    SHMEM_EXT_T *ext = comm->ext;
+    unsigned long long last_seq;
+    unsigned long long want;
+    unsigned long long dropped = 0;
+    unsigned int gen;
+    int unit_num;
+    int index;
+    SHMEM_STATUS_T ret;
+
+    if (ext == NULL)
+        return shmemReadFrameLegacy(comm, readMode, pFrame);
+
+    unit_num = *comm->unit_num;
+    last_seq = __atomic_load_n(&ext->last_seq, __ATOMIC_ACQUIRE);
+
+    switch (readMode)
+    {
+    case SHMEM_READ_NEXT:
+        want = comm->cursor;
+        break;
+    case SHMEM_READ_LATEST:
+        want = last_seq;
+        break;
+    case SHMEM_READ_SEQ:
+        want = seq;
+        break;
+    default:
+        return SHMEM_COMM_FAIL;
+    }
+
+    if (want == 0 || want > last_seq)
+        return SHMEM_COMM_NODATA;
+
+    index = shmemFindSlot(ext, unit_num, want);
+    if (index < 0)
+    {
+        // the requested frame has already been overwritten
+        if (readMode != SHMEM_READ_NEXT)
+            return SHMEM_COMM_OVERFLOW;
+
+        want = shmemOldestSeqFrom(ext, unit_num, want);
+        if (want == 0)
+            return SHMEM_COMM_NODATA;
+        index = shmemFindSlot(ext, unit_num, want);
+        if (index < 0)
+            return SHMEM_COMM_NODATA;
+    }
+
+    gen = __atomic_load_n(&ext->gen[index], __ATOMIC_ACQUIRE);
+    if ((gen & 1) || __atomic_load_n(&ext->seq[index], __ATOMIC_ACQUIRE) != want)
+        return (readMode == SHMEM_READ_SEQ) ? SHMEM_COMM_OVERFLOW : SHMEM_COMM_NODATA;
+
+    ret = shmemFillFrame(comm, index, pFrame);
+    if (ret != SHMEM_COMM_OK)
+        return ret;
+
+    if (readMode != SHMEM_READ_SEQ)
+    {
+        if (want > comm->cursor)
+            dropped = want - comm->cursor;
+        comm->cursor = want + 1;
+
+        if (comm->reader_id >= 0)
+        {
+            SHMEM_READER_T *reader = &ext->reader[comm->reader_id];
+            __atomic_store_n(&reader->dropped, reader->dropped + dropped, __ATOMIC_RELAXED);
+            __atomic_store_n(&reader->cursor, comm->cursor, __ATOMIC_RELEASE);
+            shmemReaderAdvanced(ext);
+        }
+    }
+
+    pFrame->seq     = want;
+    pFrame->gen     = gen;
+    pFrame->dropped = dropped;
+    return SHMEM_COMM_OK;
+}
+
+// Reads up to maxFrames consecutive unread frames, oldest first, with a
+// single scan of the slot table and a single cursor update. Stops at the
+// first gap, so every frame after the first has dropped == 0.
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemReadBatch(COMM_T *comm, int maxFrames, SHMEM_FRAME_T *pFrames,
+                                     int *pCount)
+{
+    SHMEM_EXT_T *ext = comm->ext;
+    unsigned long long slot_seq[SHMEM_MAX_UNITS];
+    unsigned long long last_seq;
+    unsigned long long want;
+    unsigned long long first = 0;
+    int unit_num;
+    int count = 0;
+    SHMEM_STATUS_T ret;
+
+    *pCount = 0;
+    if (ext == NULL)
+    {
+        ret = shmemReadFrameLegacy(comm, SHMEM_READ_NEXT, pFrames);
+        if (ret == SHMEM_COMM_OK)
+            *pCount = 1;
+        return ret;
+    }
+
+    unit_num = *comm->unit_num;
+    last_seq = __atomic_load_n(&ext->last_seq, __ATOMIC_ACQUIRE);
+    if (comm->cursor == 0 || comm->cursor > last_seq)
+        return SHMEM_COMM_NODATA;
+
+    for (int i = 0; i < unit_num; i++)
+    {
+        slot_seq[i] = __atomic_load_n(&ext->seq[i], __ATOMIC_ACQUIRE);
+        if (slot_seq[i] >= comm->cursor && slot_seq[i] <= last_seq
+            && (first == 0 || slot_seq[i] < first))
+            first = slot_seq[i];
+    }
+    if (first == 0)
+        return SHMEM_COMM_NODATA;
+
+    for (want = first; want <= last_seq && count < maxFrames; want++)
+    {
+        SHMEM_FRAME_T *pFrame = &pFrames[count];
+        unsigned int gen;
+        int index = -1;
+
+        for (int i = 0; i < unit_num; i++)
+        {
+            if (slot_seq[i] == want)
+            {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0)
+            break;
+
+        gen = __atomic_load_n(&ext->gen[index], __ATOMIC_ACQUIRE);
+        if ((gen & 1) || __atomic_load_n(&ext->seq[index], __ATOMIC_ACQUIRE) != want
+            || shmemFillFrame(comm, index, pFrame) != SHMEM_COMM_OK)
+            break;
+
+        pFrame->seq     = want;
+        pFrame->gen     = gen;
+        pFrame->dropped = 0;
+        count++;
+    }
+    if (count == 0)
+        return SHMEM_COMM_NODATA;
+
+    pFrames[0].dropped = first - comm->cursor;
+    comm->cursor       = pFrames[count - 1].seq + 1;
+    if (comm->reader_id >= 0)
+    {
+        SHMEM_READER_T *reader = &ext->reader[comm->reader_id];
+        __atomic_store_n(&reader->dropped, reader->dropped + pFrames[0].dropped,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&reader->cursor, comm->cursor, __ATOMIC_RELEASE);
+        shmemReaderAdvanced(ext);
+    }
+
+    *pCount = count;
+    return SHMEM_COMM_OK;
+}
+
+// A frame is still intact if its slot was not rewritten after it was read.
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemValidateFrame(COMM_T *comm, const SHMEM_FRAME_T *pFrame)
+{
+    SHMEM_EXT_T *ext = comm->ext;
+
+    if (ext == NULL || pFrame->seq == 0)
+        return SHMEM_COMM_OK;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&ext->gen[pFrame->slot], __ATOMIC_RELAXED) != pFrame->gen
+        || __atomic_load_n(&ext->seq[pFrame->slot], __ATOMIC_RELAXED) != pFrame->seq)
+    {
+        return SHMEM_COMM_OVERFLOW;
+    }
+    return SHMEM_COMM_OK;
+}
+
+// A handle holds one reference for itself and one per leased frame. Whoever
+// drops the last one, the close or the final unpin, releases the mapping.
+template <typename COMM_T>
+static void shmemUnref(COMM_T *comm, void (*release)(COMM_T *))
+{
+    if (__atomic_sub_fetch(&comm->refs, 1, __ATOMIC_SEQ_CST) == 0)
+        release(comm);
+}
+
+template <typename COMM_T>
+static SHMEM_STATUS_T shmemPinFrame(COMM_T *comm, const SHMEM_FRAME_T *pFrame,
+                                    void (*release)(COMM_T *))
+{
+    SHMEM_EXT_T *ext = comm->ext;
+    SHMEM_READER_T *reader;
+    int slot = pFrame->slot;
+
+    int leases;
+
+    if (ext == NULL || comm->reader_id < 0 || pFrame->seq == 0)
+        return SHMEM_COMM_FAIL;
+
+    // The reference is taken before closing is checked, so a concurrent
+    // close either sees it and stays attached, or is seen here.
+    leases = __atomic_add_fetch(&comm->refs, 1, __ATOMIC_SEQ_CST) - 1;
+    if (__atomic_load_n(&comm->closing, __ATOMIC_SEQ_CST))
+    {
+        shmemUnref(comm, release);
+        return SHMEM_COMM_TERMINATE;
+    }
+
+    // keep at least half of the ring writable
+    if (leases > (*comm->unit_num - 1) / 2)
+    {
+        shmemUnref(comm, release);
+        return SHMEM_COMM_FAIL;
+    }
+
+    reader = &ext->reader[comm->reader_id];
+    __atomic_add_fetch(&reader->pin[slot], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ext->gen[slot], __ATOMIC_SEQ_CST) != pFrame->gen
+        || __atomic_load_n(&ext->seq[slot], __ATOMIC_SEQ_CST) != pFrame->seq)
+    {
+        __atomic_sub_fetch(&reader->pin[slot], 1, __ATOMIC_SEQ_CST);
+        shmemUnref(comm, release);
+        return SHMEM_COMM_OVERFLOW;
+    }
+
+    return SHMEM_COMM_OK;
+}
+
+template <typename COMM_T>
+static void shmemUnpinSlot(COMM_T *comm, int slot, void (*release)(COMM_T *))
+{
+    SHMEM_READER_T *reader = &comm->ext->reader[comm->reader_id];
+
+    __atomic_sub_fetch(&reader->pin[slot], 1, __ATOMIC_SEQ_CST);
+    shmemUnref(comm, release);
+}
+
+#endif //SRC_HAL_UTILS_CAMSHM_INTERNAL_H_